@@ -0,0 +1,203 @@
+// Microbenchmarks for the controller's hot paths - make bench (virtual) or
+// make bench-pi (cross-compiled, copy legacy_plc_bench to the Pi and run it).
+//
+// The controller is compiled into this program as-is, so every path is
+// measured with the build's own flags and process image size. Each case is
+// timed per operation; the spread (p99/p999) matters as much as the mean on
+// a scan-driven controller.
+
+#define PLC_NO_MAIN
+#include "../legacy_plc.cpp"
+
+#include <algorithm>
+
+class PLCBench {
+public:
+    static const size_t REPLY_CAPACITY = 64 * 1024;         // Above any build's largest reply
+    static const size_t HTTP_OUT_CAPACITY = 1024 * 1024;
+    
+    PLCBench(LegacyPLC& plc, uint32_t iterations)
+        : plc(plc), iterations(iterations), http_out(HTTP_OUT_CAPACITY) {
+        samples.reserve(iterations);
+    }
+    
+    void run() {
+        console.flush();    // Controller startup lines ahead of the table
+        std::cout << std::endl;
+        std::cout << "case                                        ns/op      p50      p99     p999       ops/s" << std::endl;
+        
+        legacy_command("RR100");
+        legacy_command("RIB0,16");
+        legacy_command("RMI0,I3,O0,R100");
+        legacy_command("STATUS");
+        legacy_command("WR10,1234");
+        
+        http_request("GET /status HTTP/1.1\r\nHost: plc\r\n\r\n", "GET /status");
+        http_request("GET /scan HTTP/1.1\r\nHost: plc\r\n\r\n", "GET /scan");
+        http_request("GET /metrics HTTP/1.1\r\nHost: plc\r\n\r\n", "GET /metrics");
+        http_request("POST /registers?start=10 HTTP/1.1\r\nHost: plc\r\nContent-Length: 9\r\n\r\n[1, 2, 3]",
+                     "POST /registers");
+        
+        log_cycle_data();
+        scan_cycle();
+        fflush(stdout);
+    }
+
+private:
+    LegacyPLC& plc;
+    uint32_t iterations;
+    SessionBuffer http_out;
+    std::vector<uint32_t> samples;
+    
+    void legacy_command(const char* command) {
+        static char out[REPLY_CAPACITY];
+        size_t len = strlen(command);
+        start();
+        for (uint32_t i = 0; i < iterations; i++) {
+            int64_t started = monotonic_ns();
+            plc.process_legacy_command(nullptr, command, len, out, sizeof(out));
+            sample(started);
+        }
+        // Queued writes are applied by the scan - keep them from piling up
+        plc.apply_register_writes();
+        
+        char name[64];
+        snprintf(name, sizeof(name), "process_legacy_command %s", command);
+        report(name);
+    }
+    
+    void http_request(const char* raw, const char* name) {
+        const char* header_end = strstr(raw, "\r\n\r\n") + 4;
+        LegacyPLC::HttpRequest request;
+        if (!LegacyPLC::parse_http_request(raw, header_end - raw, &request)) {
+            std::cerr << "Benchmark request does not parse: " << name << std::endl;
+            return;
+        }
+        request.body = header_end;
+        
+        start();
+        for (uint32_t i = 0; i < iterations; i++) {
+            int64_t started = monotonic_ns();
+            plc.process_http_request(request, http_out);
+            sample(started);
+            http_out.clear();
+        }
+        plc.apply_register_writes();
+        
+        char label[64];
+        snprintf(label, sizeof(label), "process_http_request %s", name);
+        report(label);
+    }
+    
+    // Scan side and writer side of logging one scan: the ring copy, then
+    // encoding it into the batch (and the batch write whenever it fills)
+    void log_cycle_data() {
+        start();
+        for (uint32_t i = 0; i < iterations; i++) {
+            int64_t started = monotonic_ns();
+            plc.queue_log_record();
+            plc.drain_log_ring();
+            sample(started);
+        }
+        plc.finish_data_log();
+        report("log_cycle_data (queue + encode)");
+    }
+    
+    void scan_cycle() {
+        start();
+        for (uint32_t i = 0; i < iterations; i++) {
+            int64_t started = monotonic_ns();
+            plc.run_scan_cycle();
+            sample(started);
+        }
+        report("run_scan_cycle");
+    }
+    
+    void start() { samples.clear(); }
+    
+    void sample(int64_t started) {
+        samples.push_back(static_cast<uint32_t>(monotonic_ns() - started));
+    }
+    
+    void report(const char* name) {
+        if (samples.empty()) return;
+        uint64_t total = 0;
+        for (size_t i = 0; i < samples.size(); i++) total += samples[i];
+        std::sort(samples.begin(), samples.end());
+        
+        double mean = static_cast<double>(total) / samples.size();
+        printf("%-40s %9.0f %8u %8u %8u %11.0f\n", name, mean,
+               percentile(0.50), percentile(0.99), percentile(0.999), mean > 0 ? 1e9 / mean : 0.0);
+    }
+    
+    uint32_t percentile(double p) const {
+        size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+        return samples[index];
+    }
+};
+
+// The run's scratch log directory - segments only, nothing below it
+static void remove_log_dir(const char* dir) {
+    DIR* d = opendir(dir);
+    if (d == nullptr) return;
+    while (struct dirent* entry = readdir(d)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        std::string path = std::string(dir) + "/" + entry->d_name;
+        unlink(path.c_str());
+    }
+    closedir(d);
+    rmdir(dir);
+}
+
+int main(int argc, char* argv[]) {
+    uint32_t iterations = 100000;
+    PLCConfig config;
+    config.log_dir = nullptr;
+    config.port_offset = 3000;      // Above any controller's ports (offsets stop at 1000)
+    config.modbus_port = 0;
+    config.history_mb = 0;
+    config.snapshot_ms = 0;         // Cold start every run, no snapshot left behind
+    
+    for (int i = 1; i < argc; i++) {
+        int value = 0;
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc && PLCConfig::parse_int(argv[i + 1], &value) && value > 0) {
+            iterations = static_cast<uint32_t>(value);
+            i++;
+        }
+        else if (strcmp(argv[i], "--port-offset") == 0 && i + 1 < argc && PLCConfig::parse_int(argv[i + 1], &value)) {
+            config.port_offset = value;
+            i++;
+        }
+        else if (strcmp(argv[i], "--log-dir") == 0 && i + 1 < argc) {
+            config.log_dir = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--iterations N] [--port-offset N] [--log-dir DIR]" << std::endl;
+            return 1;
+        }
+    }
+    
+    // A fresh directory per run unless one was given, so earlier segments
+    // don't change what the logging case measures
+    char scratch[] = "/tmp/plc_bench.XXXXXX";
+    bool own_dir = config.log_dir == nullptr;
+    if (own_dir) {
+        if (mkdtemp(scratch) == nullptr) {
+            std::cerr << "Cannot create " << scratch << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        config.log_dir = scratch;
+    }
+    else if (mkdir(config.log_dir, 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Cannot create " << config.log_dir << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    
+    {
+        LegacyPLC plc(config);
+        PLCBench bench(plc, iterations);
+        bench.run();
+    }
+    if (own_dir) remove_log_dir(scratch);
+    return 0;
+}
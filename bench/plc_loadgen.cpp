@@ -0,0 +1,299 @@
+// Load generator for a running controller - make loadtest (against a local
+// virtual build) or make loadtest LOAD_HOST=<pi address> (against a Pi).
+//
+// Opens a number of persistent connections on the control and management
+// ports and keeps one request outstanding on each (closed loop), so the
+// reported rate is what the controller sustains at that concurrency. One
+// thread drives every connection through epoll - the client must not be
+// the bottleneck on a small host.
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+static int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+class LoadGenerator {
+public:
+    enum Protocol { PROTO_CONTROL, PROTO_MANAGEMENT, PROTO_COUNT };
+    
+    struct Options {
+        const char* host;
+        int control_port;
+        int http_port;
+        int control_connections;
+        int http_connections;
+        int duration_s;
+        const char* command;    // Control command, without CRLF
+        const char* path;       // Management GET path
+        
+        Options() : host("127.0.0.1"), control_port(9901), http_port(8901),
+                    control_connections(8), http_connections(8), duration_s(10),
+                    command("RR100"), path("/status") {}
+    };
+    
+    explicit LoadGenerator(const Options& options) : options(options), epoll_fd(-1) {
+        for (int i = 0; i < PROTO_COUNT; i++) errors[i] = 0;
+    }
+    
+    ~LoadGenerator() {
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (connections[i].fd >= 0) close(connections[i].fd);
+        }
+        if (epoll_fd >= 0) close(epoll_fd);
+    }
+    
+    bool run() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            std::cerr << "epoll_create1 failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        
+        snprintf(control_request, sizeof(control_request), "%s\r\n", options.command);
+        snprintf(http_request, sizeof(http_request),
+                 "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: keep-alive\r\n\r\n", options.path, options.host);
+        
+        connections.resize(options.control_connections + options.http_connections);
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& c = connections[i];
+            c.proto = static_cast<int>(i) < options.control_connections ? PROTO_CONTROL : PROTO_MANAGEMENT;
+            if (!open_connection(c)) return false;
+        }
+        
+        std::cout << "Driving " << options.host << " for " << options.duration_s << " s: "
+                  << options.control_connections << " control connection(s) on " << options.control_port
+                  << " (" << options.command << "), "
+                  << options.http_connections << " management connection(s) on " << options.http_port
+                  << " (GET " << options.path << ")" << std::endl;
+        
+        for (size_t i = 0; i < connections.size(); i++) send_request(connections[i]);
+        
+        int64_t started = monotonic_ns();
+        int64_t finish = started + static_cast<int64_t>(options.duration_s) * 1000000000LL;
+        struct epoll_event events[64];
+        while (monotonic_ns() < finish) {
+            int ready = epoll_wait(epoll_fd, events, 64, 100);
+            for (int i = 0; i < ready; i++) {
+                service(*static_cast<Connection*>(events[i].data.ptr));
+            }
+        }
+        double elapsed = (monotonic_ns() - started) / 1e9;
+        
+        std::cout << std::endl;
+        std::cout << "protocol      requests      req/s    p50 us    p99 us   p999 us    errors" << std::endl;
+        report("control", PROTO_CONTROL, elapsed);
+        report("management", PROTO_MANAGEMENT, elapsed);
+        return true;
+    }
+
+private:
+    static const size_t RX_CAPACITY = 256 * 1024;
+    
+    struct Connection {
+        int fd;
+        int proto;
+        int64_t sent_ns;        // 0 = no request outstanding
+        size_t sent;            // Bytes of the current request written
+        std::vector<char> rx;
+        size_t rx_used;
+        
+        Connection() : fd(-1), proto(PROTO_CONTROL), sent_ns(0), sent(0), rx(RX_CAPACITY), rx_used(0) {}
+    };
+    
+    Options options;
+    int epoll_fd;
+    std::vector<Connection> connections;
+    std::vector<uint32_t> latency_us[PROTO_COUNT];
+    uint32_t errors[PROTO_COUNT];
+    char control_request[256];
+    char http_request[512];
+    
+    bool open_connection(Connection& c) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", c.proto == PROTO_CONTROL ? options.control_port : options.http_port);
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* address = nullptr;
+        if (getaddrinfo(options.host, port, &hints, &address) != 0 || address == nullptr) {
+            std::cerr << "Cannot resolve " << options.host << std::endl;
+            return false;
+        }
+        
+        c.fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        bool connected = c.fd >= 0 && connect(c.fd, address->ai_addr, address->ai_addrlen) == 0;
+        freeaddrinfo(address);
+        if (!connected) {
+            std::cerr << "Cannot connect to " << options.host << ":" << port << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        
+        int one = 1;
+        setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+        
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.ptr = &c;
+        return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.fd, &event) == 0;
+    }
+    
+    void send_request(Connection& c) {
+        if (c.sent_ns == 0) {
+            c.sent_ns = monotonic_ns();
+            c.sent = 0;
+        }
+        const char* request = c.proto == PROTO_CONTROL ? control_request : http_request;
+        size_t length = strlen(request);
+        while (c.sent < length) {
+            ssize_t n = send(c.fd, request + c.sent, length - c.sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                c.sent += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return; // EPOLLOUT resumes
+            fail(c);
+            return;
+        }
+    }
+    
+    void service(Connection& c) {
+        if (c.fd < 0) return;
+        send_request(c);
+        while (c.fd >= 0) {
+            if (c.rx_used == c.rx.size()) {
+                fail(c);    // Response larger than the receive buffer
+                return;
+            }
+            ssize_t n = recv(c.fd, &c.rx[c.rx_used], c.rx.size() - c.rx_used, 0);
+            if (n > 0) {
+                c.rx_used += n;
+                consume_responses(c);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            fail(c);        // Closed by the controller
+            return;
+        }
+    }
+    
+    void consume_responses(Connection& c) {
+        size_t length;
+        while (c.sent_ns != 0 && (length = response_length(c)) > 0) {
+            int64_t now = monotonic_ns();
+            latency_us[c.proto].push_back(static_cast<uint32_t>((now - c.sent_ns) / 1000));
+            memmove(&c.rx[0], &c.rx[length], c.rx_used - length);
+            c.rx_used -= length;
+            c.sent_ns = 0;
+            send_request(c);
+        }
+    }
+    
+    // Length of the complete response at the head of rx, 0 while incomplete
+    size_t response_length(const Connection& c) const {
+        const char* data = &c.rx[0];
+        if (c.proto == PROTO_CONTROL) {
+            const char* eol = static_cast<const char*>(memchr(data, '\n', c.rx_used));
+            return eol != nullptr ? eol - data + 1 : 0;
+        }
+        
+        const char* header_end = nullptr;
+        for (size_t i = 3; i < c.rx_used; i++) {
+            if (data[i - 3] == '\r' && data[i - 2] == '\n' && data[i - 1] == '\r' && data[i] == '\n') {
+                header_end = data + i + 1;
+                break;
+            }
+        }
+        if (header_end == nullptr) return 0;
+        
+        size_t body = 0;
+        for (const char* line = data; line < header_end; ) {
+            const char* eol = static_cast<const char*>(memchr(line, '\n', header_end - line));
+            if (eol == nullptr) break;
+            if (eol - line > 15 && strncasecmp(line, "Content-Length:", 15) == 0) {
+                body = strtoul(line + 15, nullptr, 10);
+            }
+            line = eol + 1;
+        }
+        size_t total = (header_end - data) + body;
+        return total <= c.rx_used ? total : 0;
+    }
+    
+    void fail(Connection& c) {
+        errors[c.proto]++;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c.fd, nullptr);
+        close(c.fd);
+        c.fd = -1;
+    }
+    
+    void report(const char* name, int proto, double elapsed) {
+        std::vector<uint32_t>& samples = latency_us[proto];
+        if (samples.empty() && errors[proto] == 0) return;
+        std::sort(samples.begin(), samples.end());
+        printf("%-12s %9zu %10.0f %9u %9u %9u %9u\n", name, samples.size(), samples.size() / elapsed,
+               percentile(samples, 0.50), percentile(samples, 0.99), percentile(samples, 0.999), errors[proto]);
+    }
+    
+    static uint32_t percentile(const std::vector<uint32_t>& samples, double p) {
+        if (samples.empty()) return 0;
+        return samples[static_cast<size_t>(p * (samples.size() - 1) + 0.5)];
+    }
+};
+
+static bool parse_count(const char* text, int* value) {
+    char* end = nullptr;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || v < 0 || v > 100000) return false;
+    *value = static_cast<int>(v);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    LoadGenerator::Options options;
+    
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool ok = value != nullptr;
+        if (ok && strcmp(arg, "--host") == 0)                 options.host = value;
+        else if (ok && strcmp(arg, "--control-port") == 0)    ok = parse_count(value, &options.control_port);
+        else if (ok && strcmp(arg, "--http-port") == 0)       ok = parse_count(value, &options.http_port);
+        else if (ok && strcmp(arg, "--control") == 0)         ok = parse_count(value, &options.control_connections);
+        else if (ok && strcmp(arg, "--http") == 0)            ok = parse_count(value, &options.http_connections);
+        else if (ok && strcmp(arg, "--duration") == 0)        ok = parse_count(value, &options.duration_s) && options.duration_s > 0;
+        else if (ok && strcmp(arg, "--command") == 0)         options.command = value;
+        else if (ok && strcmp(arg, "--path") == 0)            options.path = value;
+        else ok = false;
+        
+        if (!ok) {
+            std::cerr << "Usage: " << argv[0] << " [--host H] [--control-port N] [--http-port N]" << std::endl;
+            std::cerr << "       [--control CONNECTIONS] [--http CONNECTIONS] [--duration S]" << std::endl;
+            std::cerr << "       [--command RR100] [--path /status]" << std::endl;
+            return 1;
+        }
+        i++;
+    }
+    
+    LoadGenerator generator(options);
+    return generator.run() ? 0 : 1;
+}
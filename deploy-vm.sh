@@ -180,6 +180,10 @@ CPUQuota=25%
 Environment="PLC_MODE=virtual"
 Environment="PLC_CONTROL_PORT=$CONTROL_PORT"
 Environment="PLC_MGMT_PORT=$MGMT_PORT"
+#Environment="PLC_MODBUS_PORT=5020"
+# Host mode: run every PLC listed in the file in this one process
+#Environment="PLC_HOST_CONFIG=$INSTALL_DIR/plant.conf"
+#Environment="PLC_HOST_WORKERS=1"
 
 # Logging configuration
 StandardOutput=journal
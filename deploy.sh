@@ -133,16 +133,38 @@ PrivateTmp=true
 ProtectSystem=strict
 ProtectHome=true
 ReadWritePaths=/var/log/legacy-plc /tmp
+# Modbus/TCP listens on the privileged port 502 (PLC_MODBUS_PORT=0 disables it)
+AmbientCapabilities=CAP_NET_BIND_SERVICE
 
 # Resource limits for Pi2
 MemoryMax=128M
 CPUQuota=50%
 
+# Real-time scan thread (SCHED_FIFO needs an RT rlimit for the pi user)
+#LimitRTPRIO=50
+#Environment="PLC_RT_PRIORITY=50"
+#Environment="PLC_CPU_AFFINITY=3"
+
 # Network settings for cluster integration
 Environment="PLC_CONTROL_VLAN=192.168.10.15"
 Environment="PLC_MGMT_VLAN=192.168.99.15"
 Environment="PLC_NODE_TYPE=legacy"
 
+# Scan tasks (MAST period, optional FAST task period; 0 = no FAST task)
+Environment="PLC_SCAN_PERIOD_MS=100"
+Environment="PLC_FAST_PERIOD_MS=0"
+#Environment="PLC_PROGRAM=/opt/legacy-plc/control.il"
+#Environment="PLC_RUNG_BUDGET_US=200"
+
+# Process-data log: delta (changes only), binary or csv; convert with --export-csv
+Environment="PLC_LOG_FORMAT=delta"
+#Environment="PLC_LOG_DEADBANDS=I0=2,I3=2,MW100=2"
+# Segments rotate by size and age; the oldest are removed past the retention limits
+Environment="PLC_LOG_DIR=/var/log/legacy-plc"
+#Environment="PLC_LOG_SEGMENT_MB=8"
+#Environment="PLC_LOG_RETENTION_MB=256"
+#Environment="PLC_LOG_RETENTION_DAYS=30"
+
 # Logging configuration
 StandardOutput=journal
 StandardError=journal
@@ -464,6 +486,7 @@ case "$COMMAND" in
         echo_success "Full deployment complete!"
         echo_info "PLC Control:    http://$PI_HOST:9001 (ASCII protocol)"
         echo_info "PLC Management: http://$PI_HOST:8080 (JSON API)"
+        echo_info "PLC Modbus/TCP: $PI_HOST:502 (holding registers = %MW)"
         echo_info "Dashboard:      http://$PI_HOST:8000 (Web interface)"
         echo_info "Dashboard API:  http://$PI_HOST:8000/api/ (CORS-friendly proxy)"
         echo ""
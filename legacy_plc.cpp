@@ -7,578 +7,6701 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <cstring>
+#include <strings.h>
 #include <chrono>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <cmath>        // Added for sin() function
-
-#ifdef VIRTUAL_HARDWARE
+#include <cerrno>
+#include <ctime>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <atomic>
+#include <thread>
+#include <pthread.h>
+#include <csignal>
+#include <algorithm>
+#include <sys/mman.h>
+#include <dirent.h>
 #include <sys/stat.h>
-#include <unistd.h>
+#include <sched.h>
+#include <deque>
+#include <mutex>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <malloc.h>
+#include <condition_variable>
+#include <cstdarg>
+#include <climits>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
 #endif
 
-// Legacy PLC Simulator - mimics early 2000s industrial controller
-class LegacyPLC {
-private:
-    // System configuration - typical of 2004-era PLCs
-    static const int CYCLE_TIME_MS = 100;  // 100ms scan cycle (10 Hz)
-    static const int MAX_INPUTS = 16;
-    static const int MAX_OUTPUTS = 16;
-    static const int MAX_REGISTERS = 256;
-    static const int TCP_PORT = 9001;  // Legacy control protocol port
-    static const int MGMT_PORT = 8080; // Management HTTP interface port
+// Process image size - fixed per build, like the controller's memory map.
+// Larger cells override these on the compiler command line, e.g.
+//   make virtual POINT_FLAGS="-DPLC_MAX_INPUTS=2048 -DPLC_DISCRETE_OUTPUTS=2048"
+// The original program and simulation use up to %I3, %Q15 and %MW101.
+#ifndef PLC_MAX_INPUTS
+#define PLC_MAX_INPUTS 16
+#endif
+#ifndef PLC_MAX_OUTPUTS
+#define PLC_MAX_OUTPUTS 16
+#endif
+#ifndef PLC_MAX_REGISTERS
+#define PLC_MAX_REGISTERS 256
+#endif
+#ifndef PLC_DISCRETE_INPUTS
+#define PLC_DISCRETE_INPUTS 64      // %IX, packed eight to a byte
+#endif
+#ifndef PLC_DISCRETE_OUTPUTS
+#define PLC_DISCRETE_OUTPUTS 64     // %QX
+#endif
+#if PLC_MAX_INPUTS < 4 || PLC_MAX_OUTPUTS < 16 || PLC_MAX_REGISTERS < 128
+#error "Point counts below the original memory map"
+#endif
+#if PLC_MAX_INPUTS > 16384 || PLC_MAX_OUTPUTS > 16384 || PLC_MAX_REGISTERS > 16384
+#error "At most 16384 points per table"
+#endif
+#if PLC_DISCRETE_INPUTS < 8 || PLC_DISCRETE_INPUTS % 8 != 0 || \
+    PLC_DISCRETE_OUTPUTS < 8 || PLC_DISCRETE_OUTPUTS % 8 != 0
+#error "Discrete banks are whole bytes"
+#endif
+
+
+// Status and diagnostic output. Callers format a line and queue it; one
+// writer thread hands whole batches to stdout and stderr with writev(), so
+// a busy journald or a stalled terminal only ever holds up that thread -
+// never the scan, the network or the data log. Under systemd
+// (JOURNAL_STREAM set) each line leads with its syslog priority, "<4>",
+// which journald strips and records. INFO and NOTICE lines are rate
+// limited; anything dropped is counted and reported by the writer.
+class ConsoleLog {
+public:
+    enum Severity { ERROR = 3, WARNING = 4, NOTICE = 5, INFO = 6 };
     
-    // PLC State
-    struct SystemState {
-        bool running;
-        uint32_t cycle_count;
-        uint16_t inputs[MAX_INPUTS];
-        uint16_t outputs[MAX_OUTPUTS]; 
-        uint16_t registers[MAX_REGISTERS];
-        uint8_t error_codes;
-        std::string last_error;
-        
-        SystemState() : running(false), cycle_count(0), error_codes(0) {
-            memset(inputs, 0, sizeof(inputs));
-            memset(outputs, 0, sizeof(outputs));
-            memset(registers, 0, sizeof(registers));
+    ConsoleLog() : head(0), tail(0), dropped(0), tokens(RATE_BURST), refilled_s(0),
+                   journal(getenv("JOURNAL_STREAM") != nullptr), stopping(false) {}
+    
+    // Static destruction (return from main, exit()) writes what is queued
+    ~ConsoleLog() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
         }
-    } state;
+        wakeup.notify_one();
+        if (writer.joinable()) writer.join();
+    }
     
-    // Network - Multi-protocol support
-    int server_socket;      // Control protocol (legacy ASCII)
-    int mgmt_socket;        // Management protocol (HTTP/JSON)
-    struct sockaddr_in server_addr;
-    struct sockaddr_in mgmt_addr;
+    __attribute__((format(printf, 2, 3))) void error(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        queue(ERROR, format, args);
+        va_end(args);
+    }
     
-    // Timing
-    std::chrono::steady_clock::time_point last_cycle;
+    __attribute__((format(printf, 2, 3))) void warning(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        queue(WARNING, format, args);
+        va_end(args);
+    }
     
-    // Legacy data logging (ASCII format typical of early PLCs)
-    std::ofstream log_file;
+    __attribute__((format(printf, 2, 3))) void notice(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        queue(NOTICE, format, args);
+        va_end(args);
+    }
     
-public:
-    LegacyPLC() : server_socket(-1), mgmt_socket(-1) {
-        initialize_system();
+    __attribute__((format(printf, 2, 3))) void info(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        queue(INFO, format, args);
+        va_end(args);
     }
     
-    ~LegacyPLC() {
-        shutdown_system();
+    // Wait until every line queued so far has been written - before output
+    // that bypasses the queue (benchmark tables)
+    void flush() {
+        std::unique_lock<std::mutex> guard(lock);
+        uint32_t target = head;
+        while (writer.joinable() && static_cast<int32_t>(tail - target) < 0) drained.wait(guard);
     }
     
-    void initialize_system() {
-#ifdef VIRTUAL_HARDWARE
-        std::cout << "=== LEGACY PLC SIMULATOR v2.1 (VIRTUAL) ===" << std::endl;
-        std::cout << "Running in virtual cluster mode" << std::endl;
-        std::cout << "Hardware simulation: ENABLED" << std::endl;
-#elif defined(RASPBERRY_PI)
-        std::cout << "=== LEGACY PLC SIMULATOR v2.1 (RASPBERRY PI) ===" << std::endl;
-        #ifdef RPI_MODEL_B
-        std::cout << "Target: Raspberry Pi Model B" << std::endl;
-        #elif defined(RPI_MODEL_2_3)
-        std::cout << "Target: Raspberry Pi 2/3" << std::endl;
-        #elif defined(RPI_MODEL_4_5)
-        std::cout << "Target: Raspberry Pi 4/5" << std::endl;
-        #endif
+private:
+    static const size_t LINE_CAPACITY = 256;        // Longer lines are cut short
+#ifdef MEMORY_CONSTRAINED
+    static const uint32_t QUEUE_LINES = 128;        // Power of two
 #else
-        std::cout << "=== LEGACY PLC SIMULATOR v2.1 ===" << std::endl;
+    static const uint32_t QUEUE_LINES = 1024;
 #endif
+    static const uint32_t BATCH_LINES = 64;         // Per writev()
+    static const uint32_t RATE_PER_S = 100;         // INFO and NOTICE refill
+    static const uint32_t RATE_BURST = QUEUE_LINES; // Startup of a full host fits
+    
+    struct Line {
+        uint8_t severity;
+        uint16_t length;
+        char text[LINE_CAPACITY];
+    };
+    
+    std::mutex lock;
+    std::condition_variable wakeup;     // Writer: lines queued, or stopping
+    std::condition_variable drained;    // flush(): tail advanced
+    Line lines[QUEUE_LINES];            // [head, tail) is the writer's; producers fill at head
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;                   // Since the last report
+    uint32_t tokens;
+    int64_t refilled_s;
+    bool journal;
+    bool stopping;
+    std::thread writer;
+    
+    void queue(Severity severity, const char* format, va_list args) {
+        char text[LINE_CAPACITY];
+        size_t length = 0;
+        if (journal) {
+            text[0] = '<';
+            text[1] = static_cast<char>('0' + severity);
+            text[2] = '>';
+            length = 3;
+        }
+        int n = vsnprintf(text + length, sizeof(text) - length - 1, format, args);
+        if (n < 0) return;
+        length = std::min(length + static_cast<size_t>(n), sizeof(text) - 2);
+        text[length++] = '\n';
         
-        std::cout << "Compatible with: Modicon, Allen-Bradley, Siemens" << std::endl;
-        std::cout << "Protocol: ASCII/TCP (Pre-OPC UA)" << std::endl;
-        std::cout << "Scan Rate: " << CYCLE_TIME_MS << "ms" << std::endl;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        bool wake;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (ts.tv_sec != refilled_s) {
+                uint64_t refill = static_cast<uint64_t>(ts.tv_sec - refilled_s) * RATE_PER_S;
+                tokens = static_cast<uint32_t>(std::min<uint64_t>(RATE_BURST, tokens + refill));
+                refilled_s = ts.tv_sec;
+            }
+            if (head - tail == QUEUE_LINES || (severity >= NOTICE && tokens == 0)) {
+                dropped++;
+                return;
+            }
+            if (severity >= NOTICE) tokens--;
+            if (!writer.joinable() && !stopping) start_writer();
+            
+            Line& line = lines[head & (QUEUE_LINES - 1)];
+            line.severity = static_cast<uint8_t>(severity);
+            line.length = static_cast<uint16_t>(length);
+            memcpy(line.text, text, length);
+            wake = head == tail;
+            head++;
+        }
+        if (wake) wakeup.notify_one();
+    }
+    
+    // Started by the first line. Signals stay with the threads that wait
+    // for them, as for the scan and logging threads.
+    void start_writer() {
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        writer = std::thread(&ConsoleLog::write_loop, this);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+    
+    void write_loop() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            while (head == tail && dropped == 0 && !stopping) wakeup.wait(guard);
+            if (head == tail && dropped == 0) return;
+            uint32_t first = tail;
+            uint32_t count = head - tail < BATCH_LINES ? head - tail : BATCH_LINES;
+            uint32_t lost = dropped;
+            dropped = 0;
+            guard.unlock();
+            
+            // Lines already queued are only rewritten once tail passes them
+            write_batch(first, count, lost);
+            
+            guard.lock();
+            tail += count;
+            drained.notify_all();
+        }
+    }
+    
+    void write_batch(uint32_t first, uint32_t count, uint32_t lost) {
+        struct iovec iov[BATCH_LINES + 1];
+        char report[96];
+        int fd = -1;
+        int used = 0;
+        if (lost > 0) {
+            int n = snprintf(report, sizeof(report), "%sConsole output: %u line(s) dropped\n",
+                             journal ? "<4>" : "", lost);
+            iov[0].iov_base = report;
+            iov[0].iov_len = static_cast<size_t>(n);
+            fd = STDERR_FILENO;
+            used = 1;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            Line& line = lines[(first + i) & (QUEUE_LINES - 1)];
+            int line_fd = line.severity <= WARNING ? STDERR_FILENO : STDOUT_FILENO;
+            if (line_fd != fd && used > 0) {
+                write_all(fd, iov, used);
+                used = 0;
+            }
+            fd = line_fd;
+            iov[used].iov_base = line.text;
+            iov[used].iov_len = line.length;
+            used++;
+        }
+        if (used > 0) write_all(fd, iov, used);
+    }
+    
+    // Console output is best effort - a failed write is not retried
+    static void write_all(int fd, struct iovec* iov, int count) {
+        while (count > 0) {
+            ssize_t n = writev(fd, iov, count);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            while (count > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+                n -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+                iov->iov_len -= n;
+            }
+        }
+    }
+    
+    ConsoleLog(const ConsoleLog&);
+    ConsoleLog& operator=(const ConsoleLog&);
+};
+
+static ConsoleLog console;
+
+
+// Event-driven I/O reactor (epoll) - services sockets as soon as they become
+// ready instead of polling accept() once per scan. Urgent handlers (the
+// control VLAN) sit in a second epoll set nested in the first: one wait
+// covers both, and the urgent set is drained before the batch and again
+// after every other handler, so management traffic delays control traffic
+// by at most one handler call.
+class Reactor {
+public:
+    // Anything registered with the reactor implements this interface
+    class Handler {
+    public:
+        virtual ~Handler() {}
+        virtual void on_io_event(uint32_t events) = 0;
+        // Called once a retired handler can no longer see events
+        virtual void release() { delete this; }
+        // Serviced ahead of every other handler
+        virtual bool urgent() const { return false; }
+    };
+    
+    Reactor() : epoll_fd(epoll_create1(EPOLL_CLOEXEC)), urgent_fd(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epoll_fd < 0) {
+            console.error("Failed to create epoll instance");
+        }
+        // Without the nested set every handler simply shares the main one
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        if (urgent_fd >= 0 && (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, urgent_fd, &ev) != 0)) {
+            close(urgent_fd);
+            urgent_fd = -1;
+        }
+    }
+    
+    ~Reactor() {
+        release_retired();
+        if (urgent_fd >= 0) {
+            close(urgent_fd);
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+    
+    bool add(int fd, uint32_t events, Handler* handler) {
+        return control(EPOLL_CTL_ADD, fd, events, handler);
+    }
+    
+    bool modify(int fd, uint32_t events, Handler* handler) {
+        return control(EPOLL_CTL_MOD, fd, events, handler);
+    }
+    
+    void remove(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        if (urgent_fd >= 0) epoll_ctl(urgent_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    
+    // Wait up to timeout_ms for I/O and dispatch every ready handler.
+    // Returns the number of events serviced.
+    int poll(int timeout_ms) {
+        if (epoll_fd < 0) {
+            if (timeout_ms > 0) usleep(timeout_ms * 1000);
+            return 0;
+        }
         
-        // Initialize network
-        setup_network();
+        struct epoll_event events[MAX_EVENTS];
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+        if (ready < 0) {
+            return 0; // EINTR - caller simply re-evaluates its deadline
+        }
         
-        // Initialize data logging with environment-specific path
+        int served = dispatch_urgent();
+        for (int i = 0; i < ready; i++) {
+            Handler* handler = static_cast<Handler*>(events[i].data.ptr);
+            if (handler == nullptr || is_retired(handler)) continue;     // nullptr: the urgent set
+            handler->on_io_event(events[i].events);
+            served++;
+            served += dispatch_urgent();
+        }
+        release_retired();
+        return served;
+    }
+    
+    // Delete a handler that has already been removed. Events for it may still
+    // be queued later in the batch being dispatched - possibly on behalf of
+    // another instance sharing this reactor - so it is skipped until the
+    // batch ends and deleted then.
+    void retire(Handler* handler) {
+        retired.push_back(handler);
+    }
+    
+    // Release retired handlers now - only outside poll(), when no batch is
+    // being dispatched (an instance shutting down)
+    void release_retired() {
+        for (size_t i = 0; i < retired.size(); i++) retired[i]->release();
+        retired.clear();
+    }
+    
+private:
+    static const int MAX_EVENTS = 32;
+    int epoll_fd;
+    int urgent_fd;
+    std::vector<Handler*> retired;
+    
+    bool is_retired(Handler* handler) const {
+        return !retired.empty() && std::find(retired.begin(), retired.end(), handler) != retired.end();
+    }
+    
+    int dispatch_urgent() {
+        if (urgent_fd < 0) return 0;
+        struct epoll_event events[MAX_EVENTS];
+        int ready = epoll_wait(urgent_fd, events, MAX_EVENTS, 0);
+        for (int i = 0; i < ready; i++) {
+            Handler* handler = static_cast<Handler*>(events[i].data.ptr);
+            if (is_retired(handler)) continue;
+            handler->on_io_event(events[i].events);
+        }
+        return ready > 0 ? ready : 0;
+    }
+    
+    bool control(int op, int fd, uint32_t events, Handler* handler) {
+        if (epoll_fd < 0 || fd < 0) return false;
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.ptr = handler;
+        return epoll_ctl(urgent_fd >= 0 && handler->urgent() ? urgent_fd : epoll_fd, op, fd, &ev) == 0;
+    }
+    
+    Reactor(const Reactor&);
+    Reactor& operator=(const Reactor&);
+};
+
+// Lock-free single-producer/single-consumer triple buffer. The writer always
+// has a private slot to fill and the reader always takes the newest complete
+// one - publishing is one atomic exchange and neither side ever waits.
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() : shared(1), writer(0), reader(2) {}
+    
+    // Writer side
+    T& write_slot() { return slots[writer]; }
+    void publish() {
+        writer = shared.exchange(writer | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+    
+    // Reader side - returns true if a newer value was picked up
+    bool update() {
+        if ((shared.load(std::memory_order_acquire) & FRESH) == 0) return false;
+        reader = shared.exchange(reader, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& read_slot() const { return slots[reader]; }
+    
+private:
+    static const uint8_t INDEX = 0x03;
+    static const uint8_t FRESH = 0x04;
+    
+    T slots[3];
+    std::atomic<uint8_t> shared;    // Middle slot index, FRESH once published
+    uint8_t writer;
+    uint8_t reader;
+};
+
+// Lock-free single-producer/single-consumer ring of fixed-size records. The
+// producer fills a slot in place and never waits: when the ring is full the
+// caller decides what to drop.
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity) : slots(capacity), mask(capacity - 1), head(0), tail(0) {}
+    
+    // Producer side - nullptr when full
+    T* acquire() {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == slots.size()) return nullptr;
+        return &slots[h & mask];
+    }
+    void publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    
+    // Consumer side - nullptr when empty
+    const T* front() const {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) return nullptr;
+        return &slots[t & mask];
+    }
+    void pop() { tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    
+private:
+    std::vector<T> slots;   // Capacity must be a power of two
+    size_t mask;
+    std::atomic<size_t> head;
+    char pad[64];           // Keep producer and consumer indices on separate cache lines
+    std::atomic<size_t> tail;
+    
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+};
+
+// Cross-thread wakeup (eventfd) - signalling never blocks, and the fd can sit
+// in the reactor like any socket
+class Notifier {
+public:
+    Notifier() : event_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {}
+    ~Notifier() {
+        if (event_fd >= 0) close(event_fd);
+    }
+    
+    int fd() const { return event_fd; }
+    
+    void signal() {
+        uint64_t one = 1;
+        ssize_t ignored = write(event_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+    
+    void clear() {
+        uint64_t count;
+        ssize_t ignored = read(event_fd, &count, sizeof(count));
+        (void)ignored;
+    }
+    
+    // Block until signalled or timeout_ms elapses
+    void wait(int timeout_ms) {
+        struct pollfd pfd;
+        pfd.fd = event_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout_ms) > 0) clear();
+    }
+    
+private:
+    int event_fd;
+    
+    Notifier(const Notifier&);
+    Notifier& operator=(const Notifier&);
+};
+
+// Fixed-capacity byte buffer - allocated once per connection and reused for
+// every request on it, so the request path itself never touches the heap
+class SessionBuffer {
+public:
+    explicit SessionBuffer(size_t capacity)
+        : buffer(new char[capacity]), capacity(capacity), head(0), tail(0) {}
+    ~SessionBuffer() { delete[] buffer; }
+    
+    const char* data() const { return buffer + head; }
+    size_t size() const { return tail - head; }
+    bool empty() const { return head == tail; }
+    size_t free_space() const { return capacity - size(); }
+    
+    // Contiguous space for n more bytes, or nullptr if they do not fit
+    char* reserve(size_t n) {
+        if (n > free_space()) return nullptr;
+        if (capacity - tail < n) {
+            memmove(buffer, buffer + head, size());
+            tail -= head;
+            head = 0;
+        }
+        return buffer + tail;
+    }
+    
+    void commit(size_t n) { tail += n; }
+    
+    bool append(const char* bytes, size_t n) {
+        char* dst = reserve(n);
+        if (dst == nullptr) return false;
+        memcpy(dst, bytes, n);
+        commit(n);
+        return true;
+    }
+    
+    void consume(size_t n) {
+        head += n;
+        if (head >= tail) head = tail = 0;
+    }
+    
+    void clear() { head = tail = 0; }
+    
+private:
+    char* buffer;
+    size_t capacity;
+    size_t head;
+    size_t tail;
+    
+    SessionBuffer(const SessionBuffer&);
+    SessionBuffer& operator=(const SessionBuffer&);
+};
+
+// Bounded text formatter over a caller-supplied buffer - replaces the
+// stringstream/setw/setfill formatting on the request path. Output beyond
+// the end of the buffer is dropped, never written.
+class FixedWriter {
+public:
+    FixedWriter(char* buffer, size_t capacity) : start(buffer), pos(buffer), end(buffer + capacity) {}
+    
+    void put(char c) {
+        if (pos < end) *pos++ = c;
+    }
+    
+    void put(const char* text) {
+        while (*text) put(*text++);
+    }
+    
+    void put(const char* text, size_t len) {
+        size_t room = end - pos;
+        if (len > room) len = room;
+        memcpy(pos, text, len);
+        pos += len;
+    }
+    
+    // String literal - length known at compile time
+    template <size_t N>
+    void put_literal(const char (&text)[N]) {
+        put(text, N - 1);
+    }
+    
+    // Text inside a JSON string value (quotes, backslashes and controls escaped)
+    void put_json_escaped(const char* text) {
+        for (; *text; text++) {
+            unsigned char c = static_cast<unsigned char>(*text);
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(*text);
+            } else if (c < 0x20) {
+                put_literal("\\u00");
+                put_uint(c, 2, 16);
+            } else {
+                put(*text);
+            }
+        }
+    }
+    
+    // Unsigned value, zero padded to at least width digits (setw + setfill('0'))
+    void put_uint(uint32_t value, int width = 0, int base = 10) {
+        static const char digits[] = "0123456789abcdef";
+        char tmp[12];
+        int n = 0;
+        do {
+            tmp[n++] = digits[value % base];
+            value /= base;
+        } while (value != 0);
+        while (n < width && n < static_cast<int>(sizeof(tmp))) tmp[n++] = '0';
+        while (n > 0) put(tmp[--n]);
+    }
+    
+    void put_uint64(uint64_t value) {
+        char tmp[20];
+        int n = 0;
+        do {
+            tmp[n++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (n > 0) put(tmp[--n]);
+    }
+    
+    size_t length() const { return pos - start; }
+    
+private:
+    char* start;
+    char* pos;
+    char* end;
+};
+
+// Management status document - everything that cannot change at runtime is
+// pre-rendered here at build time; only the process values are formatted
+// when the document is serialized once per scan
 #ifdef VIRTUAL_HARDWARE
-        std::string log_path = "/tmp/plc_data_virtual.log";
-        system("mkdir -p /tmp");
+#define STATUS_JSON_MODE \
+    "    \"mode\": \"Virtual Hardware Simulation\",\n"
+#define STATUS_JSON_CONTROL_VLAN    "Virtual (No VLAN)"
+#define STATUS_JSON_MGMT_ENDPOINT   "*:8901"
+#define STATUS_JSON_MGMT_VLAN       "Virtual (No VLAN)"
+#define STATUS_JSON_MODBUS_ENDPOINT "*:5020"
 #else
-        std::string log_path = "/tmp/plc_data.log";
+#define STATUS_JSON_MODE \
+    "    \"mode\": \"Physical Raspberry Pi\",\n" \
+    "    \"hardware\": \"Pi B v2 - 512MB RAM\",\n"
+#define STATUS_JSON_CONTROL_VLAN    "10 (Control Network)"
+#define STATUS_JSON_MGMT_ENDPOINT   "*:8080"
+#define STATUS_JSON_MGMT_VLAN       "99 (Management Network)"
+#define STATUS_JSON_MODBUS_ENDPOINT "*:502"
 #endif
-        
-        log_file.open(log_path, std::ios::app);
-        if (log_file.is_open()) {
-            log_file << "# PLC Data Log - Started " << get_timestamp();
+
+#ifdef RASPBERRY_PI
+#define STATUS_JSON_CPU_ARCHITECTURE "ARMv6 (Pi Model B)"
+#else
+#define STATUS_JSON_CPU_ARCHITECTURE "x86_64 (Virtual)"
+#endif
+
+static const char STATUS_JSON_DEVICE_INFO[] =
+    "{\n"
+    "  \"device_info\": {\n"
+    "    \"name\": \"Legacy PLC Simulator\",\n"
+    "    \"version\": \"2.1\",\n"
+    "    \"model\": \"Schneider/Modicon TSX Premium (circa 2004)\",\n"
+    STATUS_JSON_MODE
+    "    \"uptime_cycles\": ";
+
+static const char STATUS_JSON_NETWORK_INTERFACES[] =
+    "  \"network_interfaces\": {\n"
+    "    \"control_protocol\": {\n"
+    "      \"endpoint\": \"*:9001\",\n"
+    "      \"protocol\": \"Legacy ASCII\",\n"
+    "      \"purpose\": \"Real-time control communications\",\n"
+    "      \"vlan\": \"" STATUS_JSON_CONTROL_VLAN "\"\n"
+    "    },\n"
+    "    \"modbus_protocol\": {\n"
+    "      \"endpoint\": \"" STATUS_JSON_MODBUS_ENDPOINT "\",\n"
+    "      \"protocol\": \"Modbus/TCP\",\n"
+    "      \"purpose\": \"SCADA polling and setpoint writes\",\n"
+    "      \"vlan\": \"" STATUS_JSON_CONTROL_VLAN "\"\n"
+    "    },\n"
+    "    \"management_protocol\": {\n"
+    "      \"endpoint\": \"" STATUS_JSON_MGMT_ENDPOINT "\",\n"
+    "      \"protocol\": \"HTTP/JSON\",\n"
+    "      \"purpose\": \"Status monitoring and configuration\",\n"
+    "      \"vlan\": \"" STATUS_JSON_MGMT_VLAN "\"\n"
+    "    }\n"
+    "  },\n"
+    "  \"system_resources\": {\n"
+    "    \"cpu_architecture\": \"" STATUS_JSON_CPU_ARCHITECTURE "\",\n"
+    "    \"memory_usage\": \"";
+
+// Built-in control program, used when no program file is configured. IL
+// (instruction list) in the dialect accepted by LegacyPLC::compile_program():
+//   TASK MAST|FAST       following rungs belong to that task (default MAST)
+//   RUNG [label]         start a rung; each rung starts with LD or LDN
+//   LD/LDN/ST/STN/S/R    load, store, set/reset when the result is TRUE
+//   AND/ANDN/OR/ORN/XOR  logic on the current result (non-zero is TRUE), NOT
+//   ADD/SUB/MUL/DIV/MOD  arithmetic (division by zero yields 0)
+//   GT/GE/EQ/NE/LE/LT    compare the current result with the operand
+//   MOVB src:n dst       copy n words when the result is TRUE
+//   GTB/GEB/EQB/NEB/LEB/LTB src:n limit %QX<m>
+//                        when the result is TRUE, compare n words with limit
+//                        into discrete outputs m.. - the result becomes TRUE
+//                        if any of them is set (block alarm summary)
+// Operands: %I<n> inputs, %Q<n> outputs, %MW<n> registers, %IX<n>/%QX<n>
+// discrete inputs/outputs, %EB<n> error code bits, %SD0 scan cycle counter
+// (read-only), decimal or 16#hex constants. A block src:n is the first word
+// and a count, e.g. %I16:512. (* comments *) may span lines.
+static const char DEFAULT_CONTROL_PROGRAM[] =
+    "(* Original controller program *)\n"
+    "TASK FAST\n"
+    "RUNG temperature_control   (* heater on below setpoint while run enabled *)\n"
+    "    LD   %I0\n"
+    "    LT   %MW0\n"
+    "    AND  %I2\n"
+    "    ST   %Q0\n"
+    "RUNG high_temperature_alarm\n"
+    "    LD   %I0\n"
+    "    GT   %MW1\n"
+    "    ST   %Q1\n"
+    "    ST   %EB0\n"
+    "TASK MAST\n"
+    "RUNG cycle_counter\n"
+    "    LD   %SD0\n"
+    "    ST   %MW20\n"
+    "RUNG heartbeat_led         (* 50% duty over 10 scans *)\n"
+    "    LD   %SD0\n"
+    "    MOD  10\n"
+    "    LT   5\n"
+    "    ST   %Q15\n";
+
+// Runtime configuration - built-in defaults, overridden by PLC_* environment
+// variables (systemd Environment= lines), overridden by the command line
+struct PLCConfig {
+    static const int MAX_PERIOD_MS = 60000;
+    
+    int scan_period_ms; // MAST task period - the main scan (default 100ms, 10 Hz)
+    int fast_period_ms; // FAST task period (0 = no FAST task, its rungs run in MAST)
+    int rt_priority;    // SCHED_FIFO priority for the scan thread (0 = normal scheduling)
+    int cpu;            // CPU the scan thread is pinned to (-1 = no pinning)
+    int rung_budget_us; // Per-rung execution time budget (0 = rungs not timed)
+    const char* program_path;  // IL program file (nullptr = built-in program)
+    enum LogFormat { LOG_BINARY, LOG_DELTA, LOG_CSV };
+    LogFormat log_format;      // Data log encoding
+    const char* log_deadbands; // Delta log channel deadbands, "I0=2,I3=1,..." (nullptr = default)
+    const char* log_dir;       // Segment directory (ReadWritePaths in the unit file)
+    int log_segment_mb;        // Preallocated size of each segment file
+    int log_segment_hours;     // Rotate at least this often (0 = size only)
+    int log_retention_mb;      // Oldest segments removed beyond this total (0 = keep all)
+    int log_retention_days;    // ... or once older than this (0 = no age limit)
+    int history_mb;            // In-memory /history ring budget (0 = disabled)
+    int history_instances;     // Instances sharing that budget (host mode)
+    int port_offset;           // Added to both listening ports
+    const char* instance_name; // Host mode instance (nullptr = single controller)
+    int sim_seed;              // Simulated process seed; the port offset selects each instance's stream
+    int modbus_port;           // Modbus/TCP port before the offset (0 = no Modbus server)
+    int trace_events;          // Phase trace ring per thread, events (0 = tracing off)
+    int snapshot_ms;           // Retained-memory snapshot interval (0 = no snapshot, cold starts)
+    int load_delay_ms;         // Emulated program download time at startup (0 = none)
+    int listen_backlog;        // Pending connections per listening port
+    int max_control_clients;   // Open sessions on the control and on the Modbus port (VLAN 10)
+    int max_mgmt_clients;      // Open sessions on the management port (VLAN 99)
+    int control_rate;          // Requests/s per control or Modbus session (0 = unlimited)
+    int mgmt_rate;             // Requests/s per management session (0 = unlimited)
+    
+    PLCConfig() : scan_period_ms(100), fast_period_ms(0), rt_priority(0), cpu(-1),
+                  rung_budget_us(0), program_path(nullptr), log_format(LOG_BINARY),
+                  log_deadbands(nullptr), log_dir("/var/log/legacy-plc"),
+#ifdef MEMORY_CONSTRAINED
+                  log_segment_mb(4), log_segment_hours(24), log_retention_mb(64),
+#else
+                  log_segment_mb(8), log_segment_hours(24), log_retention_mb(256),
+#endif
+                  log_retention_days(30),
+#ifdef MEMORY_CONSTRAINED
+                  history_mb(2),
+#else
+                  history_mb(16),
+#endif
+                  history_instances(1), port_offset(0), instance_name(nullptr), sim_seed(1),
 #ifdef VIRTUAL_HARDWARE
-            log_file << " (Virtual Mode)";
+                  modbus_port(5020),
+#else
+                  modbus_port(502),
 #endif
-            log_file << std::endl;
-            log_file << "# Format: TIMESTAMP,CYCLE,I0-I15,O0-O15,ERR" << std::endl;
+                  trace_events(0), snapshot_ms(1000), load_delay_ms(0), listen_backlog(64),
+                  max_control_clients(16), max_mgmt_clients(64), control_rate(0), mgmt_rate(0) {}
+    
+    void load_environment() {
+        env_int("PLC_SCAN_PERIOD_MS", &scan_period_ms);
+        env_int("PLC_FAST_PERIOD_MS", &fast_period_ms);
+        env_int("PLC_RT_PRIORITY", &rt_priority);
+        env_int("PLC_CPU_AFFINITY", &cpu);
+        env_int("PLC_RUNG_BUDGET_US", &rung_budget_us);
+        const char* path = getenv("PLC_PROGRAM");
+        if (path != nullptr && *path != '\0') program_path = path;
+        const char* format = getenv("PLC_LOG_FORMAT");
+        if (format != nullptr && !parse_log_format(format)) {
+            std::cerr << "Ignoring invalid PLC_LOG_FORMAT=" << format << std::endl;
         }
+        const char* deadbands = getenv("PLC_LOG_DEADBANDS");
+        if (deadbands != nullptr && *deadbands != '\0') log_deadbands = deadbands;
+        const char* dir = getenv("PLC_LOG_DIR");
+        if (dir != nullptr && *dir != '\0') log_dir = dir;
+        env_int("PLC_LOG_SEGMENT_MB", &log_segment_mb);
+        env_int("PLC_LOG_SEGMENT_HOURS", &log_segment_hours);
+        env_int("PLC_LOG_RETENTION_MB", &log_retention_mb);
+        env_int("PLC_LOG_RETENTION_DAYS", &log_retention_days);
+        env_int("PLC_HISTORY_MB", &history_mb);
+        env_int("PLC_PORT_OFFSET", &port_offset);
+        env_int("PLC_SIM_SEED", &sim_seed);
+        env_int("PLC_MODBUS_PORT", &modbus_port);
+        env_int("PLC_TRACE_EVENTS", &trace_events);
+        env_int("PLC_SNAPSHOT_MS", &snapshot_ms);
+        env_int("PLC_LOAD_DELAY_MS", &load_delay_ms);
+        env_int("PLC_LISTEN_BACKLOG", &listen_backlog);
+        env_int("PLC_MAX_CONTROL_CLIENTS", &max_control_clients);
+        env_int("PLC_MAX_MGMT_CLIENTS", &max_mgmt_clients);
+        env_int("PLC_CONTROL_RATE", &control_rate);
+        env_int("PLC_MGMT_RATE", &mgmt_rate);
+    }
+    
+    bool parse_log_format(const char* text) {
+        if (strcmp(text, "binary") == 0) log_format = LOG_BINARY;
+        else if (strcmp(text, "delta") == 0) log_format = LOG_DELTA;
+        else if (strcmp(text, "csv") == 0) log_format = LOG_CSV;
+        else return false;
+        return true;
+    }
+    
+    // Consume option argv[i] (and its value). Returns false if not recognised
+    // or the value is invalid.
+    bool parse_option(int argc, char* argv[], int& i) {
+        if (strcmp(argv[i], "--scan-period") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &scan_period_ms);
+        }
+        if (strcmp(argv[i], "--fast-period") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &fast_period_ms);
+        }
+        if (strcmp(argv[i], "--program") == 0 && i + 1 < argc) {
+            program_path = argv[++i];
+            return true;
+        }
+        if (strcmp(argv[i], "--log-format") == 0 && i + 1 < argc) {
+            return parse_log_format(argv[++i]);
+        }
+        if (strcmp(argv[i], "--log-deadbands") == 0 && i + 1 < argc) {
+            log_deadbands = argv[++i];
+            return true;
+        }
+        if (strcmp(argv[i], "--log-dir") == 0 && i + 1 < argc) {
+            log_dir = argv[++i];
+            return true;
+        }
+        if (strcmp(argv[i], "--log-segment-mb") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &log_segment_mb);
+        }
+        if (strcmp(argv[i], "--port-offset") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &port_offset);
+        }
+        if (strcmp(argv[i], "--modbus-port") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &modbus_port);
+        }
+        if (strcmp(argv[i], "--sim-seed") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &sim_seed);
+        }
+        if (strcmp(argv[i], "--snapshot-ms") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &snapshot_ms);
+        }
+        if (strcmp(argv[i], "--load-delay-ms") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &load_delay_ms);
+        }
+        if (strcmp(argv[i], "--listen-backlog") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &listen_backlog);
+        }
+        if (strcmp(argv[i], "--max-control-clients") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &max_control_clients);
+        }
+        if (strcmp(argv[i], "--max-mgmt-clients") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &max_mgmt_clients);
+        }
+        if (strcmp(argv[i], "--control-rate") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &control_rate);
+        }
+        if (strcmp(argv[i], "--mgmt-rate") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &mgmt_rate);
+        }
+        if (strcmp(argv[i], "--trace-events") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &trace_events);
+        }
+        if (strcmp(argv[i], "--history-mb") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &history_mb);
+        }
+        if (strcmp(argv[i], "--log-retention-mb") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &log_retention_mb);
+        }
+        if (strcmp(argv[i], "--rung-budget-us") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &rung_budget_us);
+        }
+        if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &rt_priority);
+        }
+        if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            return parse_int(argv[++i], &cpu);
+        }
+        return false;
+    }
+    
+    // Cross-field checks once environment and command line are both applied
+    bool validate() const {
+        if (scan_period_ms < 1 || scan_period_ms > MAX_PERIOD_MS) {
+            std::cerr << "Scan period must be 1-" << MAX_PERIOD_MS << "ms" << std::endl;
+            return false;
+        }
+        if (fast_period_ms < 0 || (fast_period_ms > 0 && fast_period_ms >= scan_period_ms)) {
+            std::cerr << "FAST period must be shorter than the MAST period ("
+                      << scan_period_ms << "ms), or 0 to disable" << std::endl;
+            return false;
+        }
+        if (rt_priority < 0 || rt_priority > 99) {
+            std::cerr << "Real-time priority must be 0-99" << std::endl;
+            return false;
+        }
+        if (cpu < -1) {
+            std::cerr << "CPU must be a core number, or -1 for no pinning" << std::endl;
+            return false;
+        }
+        if (rung_budget_us < 0) {
+            std::cerr << "Rung budget cannot be negative" << std::endl;
+            return false;
+        }
+        if (log_segment_mb < 1 || log_segment_mb > 1024) {
+            std::cerr << "Log segment size must be 1-1024MB" << std::endl;
+            return false;
+        }
+        if (log_retention_mb < 0 || (log_retention_mb > 0 && log_retention_mb < 2 * log_segment_mb)) {
+            std::cerr << "Log retention must be at least two segments (" << 2 * log_segment_mb
+                      << "MB), or 0 to keep everything" << std::endl;
+            return false;
+        }
+        if (log_segment_hours < 0 || log_retention_days < 0) {
+            std::cerr << "Log rotation and retention ages cannot be negative" << std::endl;
+            return false;
+        }
+        // The unit runs under MemoryMax=128M (64M on VMs)
+        if (history_mb < 0 || history_mb > 96) {
+            std::cerr << "History budget must be 0-96MB" << std::endl;
+            return false;
+        }
+        if (snapshot_ms < 0 || snapshot_ms > MAX_PERIOD_MS) {
+            std::cerr << "Snapshot interval must be 0-" << MAX_PERIOD_MS << "ms" << std::endl;
+            return false;
+        }
+        if (load_delay_ms < 0 || load_delay_ms > 10000) {
+            std::cerr << "Program load delay must be 0-10000ms" << std::endl;
+            return false;
+        }
+        if (listen_backlog < 1 || listen_backlog > 4096) {
+            std::cerr << "Listen backlog must be 1-4096" << std::endl;
+            return false;
+        }
+        if (max_control_clients < 1 || max_control_clients > 1024 ||
+            max_mgmt_clients < 1 || max_mgmt_clients > 1024) {
+            std::cerr << "Client limits must be 1-1024" << std::endl;
+            return false;
+        }
+        if (control_rate < 0 || control_rate > 100000 || mgmt_rate < 0 || mgmt_rate > 100000) {
+            std::cerr << "Request rates must be 0-100000/s" << std::endl;
+            return false;
+        }
+        if (trace_events < 0 || trace_events > 1048576) {
+            std::cerr << "Trace ring must be 0-1048576 events" << std::endl;
+            return false;
+        }
+        if (port_offset < 0 || port_offset > 1000) {
+            std::cerr << "Port offset must be 0-1000" << std::endl;
+            return false;
+        }
+        if (modbus_port < 0 || modbus_port + port_offset > 65535) {
+            std::cerr << "Modbus port must be 1-" << 65535 - port_offset << ", or 0 to disable" << std::endl;
+            return false;
+        }
+        if (sim_seed < 0) {
+            std::cerr << "Simulation seed cannot be negative" << std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    static bool parse_int(const char* text, int* value) {
+        char* end = nullptr;
+        errno = 0;
+        long v = strtol(text, &end, 10);
+        if (end == text || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX) return false;
+        *value = static_cast<int>(v);
+        return true;
+    }
+    
+    static void env_int(const char* name, int* value) {
+        const char* text = getenv(name);
+        if (text != nullptr && !parse_int(text, value)) {
+            std::cerr << "Ignoring invalid " << name << "=" << text << std::endl;
+        }
+    }
+};
+
+// Monotonic clock in nanoseconds - the time base for scan scheduling
+static inline int64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+// Block until an absolute CLOCK_MONOTONIC time
+static inline void sleep_until(int64_t deadline_ns) {
+    struct timespec wake_at;
+    wake_at.tv_sec = deadline_ns / 1000000000LL;
+    wake_at.tv_nsec = deadline_ns % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake_at, nullptr) == EINTR) {}
+}
+
+// Hot-path instrumentation behind /metrics. Every counter has exactly one
+// writer - the scan, communications or data log thread that owns it - so an
+// update is a relaxed load and store: a plain LDR/STR on the ARMv6 Model B,
+// with no LDREX/STREX retry loop or barrier. Readers on the management side
+// see each word untorn, just possibly a scan stale. Counts are 32-bit and
+// wrap like any Prometheus counter reset.
+class MetricCounter {
+public:
+    MetricCounter() : count(0) {}
+    
+    void add(uint32_t n) { count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint32_t value() const { return count.load(std::memory_order_relaxed); }
+    
+private:
+    std::atomic<uint32_t> count;
+};
+
+// Latency histogram in microseconds, rendered as a Prometheus histogram
+class LatencyHistogram {
+public:
+    static const int BUCKETS = 13;
+    
+    LatencyHistogram() : carry_ns(0) {}
+    
+    void record(int64_t started_ns, int64_t finished_ns) {
+        uint32_t ns = static_cast<uint32_t>(finished_ns - started_ns);
+        uint32_t us = ns / 1000;
+        int bucket = 0;
+        while (bucket < BUCKETS - 1 && us > bucket_limit_us(bucket)) bucket++;
+        counts[bucket].add(1);
+        
+        // Most phases take well under a microsecond - keep the remainder so
+        // the sum does not truncate to zero
+        carry_ns += ns % 1000;
+        if (carry_ns >= 1000) {
+            us += carry_ns / 1000;
+            carry_ns %= 1000;
+        }
+        sum_us.add(us);
+    }
+    
+    uint32_t count() const {
+        uint32_t total = 0;
+        for (int i = 0; i < BUCKETS; i++) total += counts[i].value();
+        return total;
+    }
+    
+    // Inclusive upper bound of each bucket; the last is +Inf
+    static uint32_t bucket_limit_us(int bucket) {
+        static const uint32_t limits[BUCKETS - 1] = { 1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 };
+        return limits[bucket];
+    }
+    
+    // name_bucket{labels,le="..."} (cumulative), name_sum{labels}, name_count{labels}
+    void render(FixedWriter& out, const char* name, const char* labels) const {
+        uint32_t cumulative = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            cumulative += counts[i].value();
+            out.put(name);
+            out.put_literal("_bucket{");
+            out.put(labels);
+            out.put_literal(",le=\"");
+            if (i < BUCKETS - 1) out.put_uint(bucket_limit_us(i)); else out.put_literal("+Inf");
+            out.put_literal("\"} ");
+            out.put_uint(cumulative);
+            out.put('\n');
+        }
+        out.put(name);
+        out.put_literal("_sum{");
+        out.put(labels);
+        out.put_literal("} ");
+        out.put_uint(sum_us.value());
+        out.put('\n');
+        out.put(name);
+        out.put_literal("_count{");
+        out.put(labels);
+        out.put_literal("} ");
+        out.put_uint(cumulative);
+        out.put('\n');
+    }
+    
+private:
+    MetricCounter counts[BUCKETS];
+    MetricCounter sum_us;
+    uint32_t carry_ns;      // Writer only
+};
+
+// Phase tracing (--trace-events): the newest events of one writer thread in
+// a fixed ring. The writer fills a slot and then publishes the head, with
+// no lock and no allocation. A reader copies a range and afterwards checks
+// that the writer has not lapped it, as /history does. Events are complete
+// spans (begin + duration), so a traced phase costs one slot, and the
+// timestamps are the ones its LatencyHistogram already took.
+class TraceRing {
+public:
+    struct Event {
+        int64_t start_ns;       // CLOCK_MONOTONIC
+        uint32_t duration_ns;   // 0 = instant event
+        uint16_t name;          // Owner's event table
+        uint16_t arg;           // Task, file descriptor, ...
+    };
+    
+    TraceRing() : mask(0), head(0) {}
+    
+    // Power-of-two capacity; 0 leaves tracing off
+    void resize(uint32_t capacity) {
+        events.assign(capacity, Event());
+        mask = capacity > 0 ? capacity - 1 : 0;
+    }
+    
+    bool enabled() const { return !events.empty(); }
+    uint32_t capacity() const { return static_cast<uint32_t>(events.size()); }
+    
+    void record(uint16_t name, uint16_t arg, int64_t started_ns, int64_t finished_ns) {
+        if (events.empty()) return;
+        uint32_t h = head.load(std::memory_order_relaxed);
+        Event& event = events[h & mask];
+        event.start_ns = started_ns;
+        event.duration_ns = static_cast<uint32_t>(finished_ns - started_ns);
+        event.name = name;
+        event.arg = arg;
+        head.store(h + 1, std::memory_order_release);
+    }
+    
+    // Copy up to max_events of the newest events, oldest first. Slots the
+    // writer may have reused meanwhile are dropped. Returns the count.
+    uint32_t snapshot(Event* out, uint32_t max_events) const {
+        if (events.empty()) return 0;
+        uint32_t hi = head.load(std::memory_order_acquire);
+        uint32_t available = hi < capacity() ? hi : capacity();
+        uint32_t count = available < max_events ? available : max_events;
+        uint32_t lo = hi - count;
+        for (uint32_t i = 0; i < count; i++) out[i] = events[(lo + i) & mask];
+        
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint32_t now = head.load(std::memory_order_relaxed);
+        uint32_t overwritten = now - lo > capacity() ? now - lo - capacity() : 0;
+        if (overwritten >= count) return 0;
+        if (overwritten > 0) memmove(out, out + overwritten, (count - overwritten) * sizeof(Event));
+        return count - overwritten;
+    }
+    
+private:
+    std::vector<Event> events;
+    uint32_t mask;
+    std::atomic<uint32_t> head;     // Events ever recorded
+};
+
+// Kernels behind the IL block instructions - one threshold or alarm compare
+// across a whole block of analog points, the inner loop of a large cell's
+// program. AVX2/SSE2 on the virtual build (-march=native), NEON on Pi 2/3
+// (-mfpu=neon-vfpv4) and Pi 4/5, scalar on the Model B. Results are packed
+// into discrete bits LSB first, point n at byte n/8, mask 1 << (n % 8) -
+// the layout OPERAND_BIT addresses.
+class BlockKernels {
+public:
+    enum Compare { CMP_GT, CMP_LT, CMP_EQ };
+    
+    // Bit i of dst (counted from dst_bit) = src[i] <op> limit, inverted when
+    // asked (GE = !LT, LE = !GT, NE = !EQ). Returns true if any bit is set.
+    static bool compare(const uint16_t* src, uint32_t count, uint16_t limit, Compare op, bool invert,
+                        uint8_t* dst, uint32_t dst_bit) {
+        uint32_t any = 0;
+        uint32_t i = 0;
+#if defined(__AVX2__)
+        const __m256i bias = _mm256_set1_epi16(static_cast<short>(0x8000));
+        const __m256i lim = _mm256_set1_epi16(static_cast<short>(limit ^ 0x8000));
+        const uint32_t flip32 = invert ? 0xFFFFFFFFu : 0;
+        for (; i + 32 <= count; i += 32) {
+            // Unsigned compare as signed, both sides biased by 0x8000
+            __m256i a = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)), bias);
+            __m256i b = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 16)), bias);
+            __m256i ca = compare_avx2(a, lim, op);
+            __m256i cb = compare_avx2(b, lim, op);
+            // packs works per 128-bit lane - restore point order before the movemask
+            __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(ca, cb), 0xD8);
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(bytes)) ^ flip32;
+            store_bits(dst, dst_bit + i, mask, 32);
+            any |= mask;
+        }
+#endif
+#if defined(__SSE2__)
+        const __m128i bias128 = _mm_set1_epi16(static_cast<short>(0x8000));
+        const __m128i lim128 = _mm_set1_epi16(static_cast<short>(limit ^ 0x8000));
+        const uint32_t flip16 = invert ? 0xFFFFu : 0;
+        for (; i + 16 <= count; i += 16) {
+            __m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), bias128);
+            __m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 8)), bias128);
+            __m128i bytes = _mm_packs_epi16(compare_sse2(a, lim128, op), compare_sse2(b, lim128, op));
+            uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(bytes)) ^ flip16;
+            store_bits(dst, dst_bit + i, mask, 16);
+            any |= mask;
+        }
+#elif defined(__ARM_NEON)
+        static const uint8_t weights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+        const uint8x16_t weight = vld1q_u8(weights);
+        const uint16x8_t lim = vdupq_n_u16(limit);
+        const uint32_t flip16 = invert ? 0xFFFFu : 0;
+        for (; i + 16 <= count; i += 16) {
+            uint8x16_t bytes = vcombine_u8(vmovn_u16(compare_neon(vld1q_u16(src + i), lim, op)),
+                                           vmovn_u16(compare_neon(vld1q_u16(src + i + 8), lim, op)));
+            // No movemask on NEON: weight each byte by its bit and add pairwise
+            uint8x16_t weighted = vandq_u8(bytes, weight);
+            uint8x8_t sum = vpadd_u8(vget_low_u8(weighted), vget_high_u8(weighted));
+            sum = vpadd_u8(sum, sum);
+            sum = vpadd_u8(sum, sum);
+            uint32_t mask = (vget_lane_u8(sum, 0) | (static_cast<uint32_t>(vget_lane_u8(sum, 1)) << 8)) ^ flip16;
+            store_bits(dst, dst_bit + i, mask, 16);
+            any |= mask;
+        }
+#endif
+        for (; i < count; i++) {
+            bool hit = op == CMP_GT ? src[i] > limit : (op == CMP_LT ? src[i] < limit : src[i] == limit);
+            uint32_t bit = hit != invert;
+            store_bits(dst, dst_bit + i, bit, 1);
+            any |= bit;
+        }
+        return any != 0;
+    }
+    
+private:
+    // Write the low width bits of value at bit position bit of dst
+    static inline void store_bits(uint8_t* dst, uint32_t bit, uint32_t value, int width) {
+        while (width > 0) {
+            int shift = bit & 7;
+            int take = std::min(8 - shift, width);
+            uint8_t mask = static_cast<uint8_t>(((1u << take) - 1) << shift);
+            uint8_t& byte = dst[bit >> 3];
+            byte = static_cast<uint8_t>((byte & ~mask) | ((value << shift) & mask));
+            value >>= take;
+            bit += take;
+            width -= take;
+        }
+    }
+    
+#if defined(__AVX2__)
+    static inline __m256i compare_avx2(__m256i biased, __m256i limit, Compare op) {
+        return op == CMP_GT ? _mm256_cmpgt_epi16(biased, limit) :
+               op == CMP_LT ? _mm256_cmpgt_epi16(limit, biased) : _mm256_cmpeq_epi16(biased, limit);
+    }
+#endif
+#if defined(__SSE2__)
+    static inline __m128i compare_sse2(__m128i biased, __m128i limit, Compare op) {
+        return op == CMP_GT ? _mm_cmpgt_epi16(biased, limit) :
+               op == CMP_LT ? _mm_cmplt_epi16(biased, limit) : _mm_cmpeq_epi16(biased, limit);
+    }
+#elif defined(__ARM_NEON)
+    static inline uint16x8_t compare_neon(uint16x8_t values, uint16x8_t limit, Compare op) {
+        return op == CMP_GT ? vcgtq_u16(values, limit) :
+               op == CMP_LT ? vcltq_u16(values, limit) : vceqq_u16(values, limit);
+    }
+#endif
+};
+
+// Source of the simulated process signals. Each controller owns one, so
+// hosted instances never share or lock generator state, and a seed replays
+// the same input stream - reproducible load tests and many-instance runs.
+// Noise is PCG32 (XSH-RR); periodic signals come from a sine table indexed
+// by a 32-bit phase instead of std::sin every scan.
+class SignalGenerator {
+public:
+    static const int SINE_BITS = 10;
+    
+    // stream selects one of 2^63 independent sequences for the same seed
+    explicit SignalGenerator(uint64_t seed = 1, uint64_t stream = 0) { reseed(seed, stream); }
+    
+    void reseed(uint64_t seed, uint64_t stream) {
+        state = 0;
+        increment = (stream << 1) | 1u;
+        next();
+        state += seed;
+        next();
+    }
+    
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rotation = static_cast<uint32_t>(old >> 59);
+        return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+    }
+    
+    // Uniform in [0, range) by multiply-shift - no division on the Model B
+    uint32_t uniform(uint32_t range) {
+        return static_cast<uint32_t>((static_cast<uint64_t>(next()) * range) >> 32);
+    }
+    
+    // Uniform in [low, high]
+    int32_t between(int32_t low, int32_t high) {
+        return low + static_cast<int32_t>(uniform(static_cast<uint32_t>(high - low) + 1));
+    }
+    
+    // sin() of a phase where 2^32 is one full turn
+    static float sine(uint32_t phase) {
+        return sine_table().values[phase >> (32 - SINE_BITS)];
+    }
+    
+private:
+    struct SineTable {
+        float values[1 << SINE_BITS];
+        SineTable() {
+            for (int i = 0; i < (1 << SINE_BITS); i++) {
+                values[i] = static_cast<float>(std::sin(2 * M_PI * i / (1 << SINE_BITS)));
+            }
+        }
+    };
+    
+    // One table for every instance, built on first use
+    static const SineTable& sine_table() {
+        static const SineTable table;
+        return table;
+    }
+    
+    uint64_t state;
+    uint64_t increment;
+};
+
+// Virtual run-enable switch: while /tmp/plc_stop exists, %I2 reads 0. The
+// directory is watched with inotify instead of a stat() every scan. The
+// file is process-wide, and so is its state - one watch is registered by
+// whoever owns the reactor (the controller, or the host for all of its
+// instances).
+class StopFileWatch : public Reactor::Handler {
+public:
+    StopFileWatch() : fd(-1) {}
+    ~StopFileWatch() {
+        if (fd >= 0) close(fd);
+    }
+    
+    void start(Reactor& reactor) {
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0 || inotify_add_watch(fd, "/tmp", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) < 0) {
+            console.warning("Failed to watch /tmp for plc_stop: %s", strerror(errno));
+            if (fd >= 0) close(fd);
+            fd = -1;
+        } else {
+            reactor.add(fd, EPOLLIN, this);
+        }
+        refresh();
+    }
+    
+    void stop(Reactor& reactor) {
+        if (fd < 0) return;
+        reactor.remove(fd);
+        close(fd);
+        fd = -1;
+    }
+    
+    static bool present() { return flag().load(std::memory_order_relaxed); }
+    
+    void on_io_event(uint32_t /*events*/) override {
+        alignas(struct inotify_event) char buffer[4096];
+        bool changed = false;
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + n; ) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+                if ((event->mask & IN_Q_OVERFLOW) || (event->len > 0 && strcmp(event->name, "plc_stop") == 0)) {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (changed) refresh();
+    }
+    
+private:
+    int fd;
+    
+    static std::atomic<bool>& flag() {
+        static std::atomic<bool> value(false);
+        return value;
+    }
+    
+    static void refresh() {
+        struct stat buffer;
+        flag().store(stat("/tmp/plc_stop", &buffer) == 0, std::memory_order_relaxed);
+    }
+};
+
+// Wall-clock text for replies, documents and log lines. localtime_r() and
+// strftime() run once per second per thread; every other call is a clock
+// read and a short copy. The cache is thread_local, so the scan, logging
+// and network threads never share or lock it. Intervals and deadlines use
+// monotonic_ns() instead - the wall clock can be stepped.
+class Timestamp {
+public:
+    static const size_t LOCAL_LENGTH = 19;      // "YYYY-MM-DD HH:MM:SS"
+    static const size_t LOCAL_MS_LENGTH = 23;   // + ".mmm"
+    static const size_t ISO8601_LENGTH = 29;    // "YYYY-MM-DDTHH:MM:SS.mmm+hh:mm"
+    
+    // Wall clock in microseconds since the epoch
+    static int64_t now_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+    }
+    
+    // Current local time to the second. The coarse clock is a plain memory
+    // read in the vDSO; being a tick late at the second boundary is harmless.
+    static size_t local(char* buffer, size_t size) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+        return copy(cached(ts.tv_sec).text, LOCAL_LENGTH, buffer, size);
+    }
+    
+    // Local time with milliseconds for a now_us() value or a recorded sample
+    static size_t local_ms(int64_t time_us, char* buffer, size_t size) {
+        char text[LOCAL_MS_LENGTH];
+        memcpy(text, cached(time_us / 1000000).text, LOCAL_LENGTH);
+        put_millis(text + LOCAL_LENGTH, time_us);
+        return copy(text, LOCAL_MS_LENGTH, buffer, size);
+    }
+    
+    // ISO-8601 with the local UTC offset, for machine consumers
+    static size_t iso8601(int64_t time_us, char* buffer, size_t size) {
+        const Cache& cache = cached(time_us / 1000000);
+        char text[ISO8601_LENGTH];
+        memcpy(text, cache.text, LOCAL_LENGTH);
+        text[10] = 'T';
+        put_millis(text + LOCAL_LENGTH, time_us);
+        memcpy(text + LOCAL_MS_LENGTH, cache.zone, 6);
+        return copy(text, ISO8601_LENGTH, buffer, size);
+    }
+    
+private:
+    struct Cache {
+        int64_t second;
+        char text[LOCAL_LENGTH + 1];
+        char zone[7];               // "+hh:mm"
+    };
+    
+    static const Cache& cached(int64_t second) {
+        static thread_local Cache cache = { -1, { 0 }, { 0 } };
+        if (cache.second != second) {
+            time_t t = static_cast<time_t>(second);
+            struct tm local;
+            localtime_r(&t, &local);
+            strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &local);
+            long offset = local.tm_gmtoff / 60;
+            cache.zone[0] = offset < 0 ? '-' : '+';
+            if (offset < 0) offset = -offset;
+            cache.zone[1] = static_cast<char>('0' + offset / 600 % 10);
+            cache.zone[2] = static_cast<char>('0' + offset / 60 % 10);
+            cache.zone[3] = ':';
+            cache.zone[4] = static_cast<char>('0' + offset % 60 / 10);
+            cache.zone[5] = static_cast<char>('0' + offset % 10);
+            cache.zone[6] = '\0';
+            cache.second = second;
+        }
+        return cache;
+    }
+    
+    static void put_millis(char* p, int64_t time_us) {
+        int millis = static_cast<int>(time_us % 1000000 / 1000);
+        p[0] = '.';
+        p[1] = static_cast<char>('0' + millis / 100);
+        p[2] = static_cast<char>('0' + millis / 10 % 10);
+        p[3] = static_cast<char>('0' + millis % 10);
+    }
+    
+    // NUL-terminated, truncated to the buffer; returns the length copied
+    static size_t copy(const char* text, size_t length, char* buffer, size_t size) {
+        if (size == 0) return 0;
+        if (length >= size) length = size - 1;
+        memcpy(buffer, text, length);
+        buffer[length] = '\0';
+        return length;
+    }
+};
+
+// Process memory for the status document: resident set and its high-water
+// mark from the kernel, heap in use from the allocator, and the cgroup limit
+// (systemd MemoryMax=). /proc and mallinfo() are too slow to read on every
+// scan of every hosted instance, so each thread samples at most once a
+// second; in practice only the communications thread asks.
+class MemoryUsage {
+public:
+    struct Sample {
+        int64_t second;         // CLOCK_MONOTONIC_COARSE second of the sample
+        uint32_t rss_kb;
+        uint32_t rss_peak_kb;
+        uint32_t heap_kb;       // Main arena - every arena with MEMORY_CONSTRAINED
+        uint32_t heap_peak_kb;  // Highest heap_kb sampled
+        uint32_t limit_kb;      // 0 = no limit
+    };
+    
+    static const Sample& current() {
+        static thread_local Sample sample = { -1, 0, 0, 0, 0, cgroup_limit_kb() };
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        if (sample.second != ts.tv_sec) {
+            sample.second = ts.tv_sec;
+            sample.rss_kb = resident_kb();
+            struct rusage usage;
+            if (getrusage(RUSAGE_SELF, &usage) == 0) sample.rss_peak_kb = static_cast<uint32_t>(usage.ru_maxrss);
+            if (sample.rss_kb > sample.rss_peak_kb) sample.rss_peak_kb = sample.rss_kb;    // Sampled a page apart
+            sample.heap_kb = heap_kb();
+            if (sample.heap_kb > sample.heap_peak_kb) sample.heap_peak_kb = sample.heap_kb;
+        }
+        return sample;
+    }
+    
+private:
+    static uint32_t resident_kb() {
+        char text[64];
+        if (!read_text("/proc/self/statm", text, sizeof(text))) return 0;
+        unsigned long pages = 0, resident = 0;
+        if (sscanf(text, "%lu %lu", &pages, &resident) != 2) return 0;
+        return static_cast<uint32_t>(resident * (sysconf(_SC_PAGESIZE) / 1024));
+    }
+    
+    static uint32_t heap_kb() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        struct mallinfo2 info = mallinfo2();
+        return static_cast<uint32_t>((info.uordblks + info.hblkhd) / 1024);
+#elif defined(__GLIBC__)
+        struct mallinfo info = mallinfo();
+        return static_cast<uint32_t>((static_cast<unsigned long>(info.uordblks) + info.hblkhd) / 1024);
+#else
+        return 0;
+#endif
+    }
+    
+    // memory.max (cgroup v2) or memory.limit_in_bytes (v1) of this
+    // process's cgroup, read once
+    static uint32_t cgroup_limit_kb() {
+        char groups[1024];
+        if (!read_text("/proc/self/cgroup", groups, sizeof(groups))) return 0;
+        for (char* line = strtok(groups, "\n"); line != nullptr; line = strtok(nullptr, "\n")) {
+            char path[1200];
+            if (strncmp(line, "0::", 3) == 0) {
+                snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.max", line + 3);
+            } else if (strstr(line, ":memory:") != nullptr) {
+                snprintf(path, sizeof(path), "/sys/fs/cgroup/memory%s/memory.limit_in_bytes", strstr(line, ":memory:") + 8);
+            } else {
+                continue;
+            }
+            char value[32];
+            if (!read_text(path, value, sizeof(value))) continue;
+            unsigned long long bytes = strtoull(value, nullptr, 10);
+            // "max", or v1's page-rounded LLONG_MAX
+            if (bytes == 0 || bytes >= (1ULL << 42)) return 0;
+            return static_cast<uint32_t>(bytes / 1024);
+        }
+        return 0;
+    }
+    
+    static bool read_text(const char* path, char* buffer, size_t size) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        ssize_t n = read(fd, buffer, size - 1);
+        close(fd);
+        if (n <= 0) return false;
+        buffer[n] = '\0';
+        return true;
+    }
+};
+
+// Buffer size for a larger process image, never below the original
+static constexpr size_t size_at_least(size_t floor, size_t needed) {
+    return needed > floor ? needed : floor;
+}
+
+// Legacy PLC Simulator - mimics early 2000s industrial controller
+class LegacyPLC {
+private:
+    // System configuration - typical of 2004-era PLCs (see PLC_MAX_INPUTS)
+    static const int MAX_INPUTS = PLC_MAX_INPUTS;
+    static const int MAX_OUTPUTS = PLC_MAX_OUTPUTS;
+    static const int MAX_REGISTERS = PLC_MAX_REGISTERS;
+    static const int MAX_POINTS = MAX_INPUTS > MAX_OUTPUTS ? (MAX_INPUTS > MAX_REGISTERS ? MAX_INPUTS : MAX_REGISTERS) :
+                                  (MAX_OUTPUTS > MAX_REGISTERS ? MAX_OUTPUTS : MAX_REGISTERS);
+    static const int LEGACY_INPUTS = 16;                // Simulated beyond this only in larger builds
+    static const int MAX_DISCRETE_INPUTS = PLC_DISCRETE_INPUTS;
+    static const int MAX_DISCRETE_OUTPUTS = PLC_DISCRETE_OUTPUTS;
+    static const int TCP_PORT = 9001;  // Legacy control protocol port
+    static const int MGMT_PORT = 8080; // Management HTTP interface port
+    static const size_t MAX_COMMAND_LENGTH = 256;   // Longest accepted control command line
+    static const size_t MODBUS_ADU_MAX = 260;       // MBAP header plus the longest PDU
+    static const size_t MODBUS_RX_CAPACITY = MODBUS_ADU_MAX * 16;   // Pipelined requests
+    static const size_t MODBUS_TX_CAPACITY = MODBUS_ADU_MAX * 16;
+    // Worst-case control reply: the largest point block of 5-digit values plus CRLF
+    static const size_t MAX_REPLY_LENGTH = MAX_POINTS * 6 + 8;
+    static const size_t CONTROL_RX_CAPACITY = MAX_COMMAND_LENGTH * 16;
+    static const size_t CONTROL_TX_CAPACITY = MAX_REPLY_LENGTH * 4;
+    static const size_t MGMT_RX_CAPACITY = 8 * 1024;     // Also the largest accepted request
+    static const int LOG_CHANNELS = 1 + MAX_INPUTS + MAX_OUTPUTS + MAX_REGISTERS;  // error_codes first
+    static const size_t DISCRETE_HEX_LENGTH = (MAX_DISCRETE_INPUTS + MAX_DISCRETE_OUTPUTS) / 4;
+    // Buffers that hold every point grow with the process image, never below
+    // the sizes of the original 16/16/256 map
+    static const size_t MGMT_MAX_RESPONSE = size_at_least(32 * 1024, LOG_CHANNELS * 8 + DISCRETE_HEX_LENGTH + 1024);  // Headers plus the largest body (/metrics)
+    static const size_t STATUS_JSON_CAPACITY = 4096;
+    static const size_t SSE_EVENT_CAPACITY = size_at_least(8 * 1024, LOG_CHANNELS * 14 + 256);  // Every point changed, plus framing
+    static const size_t MGMT_TX_CAPACITY = size_at_least(size_at_least(64 * 1024, SSE_EVENT_CAPACITY * 4), MGMT_MAX_RESPONSE * 2);
+    static const uint32_t SSE_KEEPALIVE_CYCLES = 150;    // Comment line when idle (~15 s)
+    static const size_t POINT_EVENT_HEAD = 16;           // "EVT<cycle>" and CRLF
+    static const size_t POINT_EVENT_ENTRY = 14;          // ",R16383=65535"
+    static const size_t TRACE_EVENT_JSON_MAX = 160;      // One rendered trace event
+    static const size_t PROGRAM_MEMORY = 64 * 1024;      // Compiled program limit, both tasks
+    static const int MAX_RUNG_INSTRUCTIONS = 256;
+#ifdef MEMORY_CONSTRAINED
+    static const size_t LOG_RING_RECORDS = 128;         // Scans queued for the log writer
+    static const size_t HOSTED_LOG_RING_RECORDS = 128;
+    static const size_t LOG_BATCH_BYTES = 32 * 1024;
+#else
+    static const size_t LOG_RING_RECORDS = 1024;
+    static const size_t HOSTED_LOG_RING_RECORDS = 256;  // Host log thread drains every 50ms
+    static const size_t LOG_BATCH_BYTES = 64 * 1024;    // One write() per batch
+#endif
+    static const int64_t LOG_FLUSH_INTERVAL_NS = 10000000000LL;  // Longest a sample waits in RAM
+    static const size_t LOG_CSV_LINE_MAX = size_at_least(2048, LOG_CHANNELS * 6 + 64);  // Timestamp, cycle and every point
+    static const size_t LOG_DELTA_RECORD_MAX = size_at_least(2048, LOG_CHANNELS * 7 + 64);  // Worst case: every channel changed, framed
+    static const uint32_t LOG_KEYFRAME_CYCLES = 600;    // Full snapshot at least this often
+    static const size_t SEGMENT_STREAM_HEADER_OFFSET = 256;
+    static const uint32_t SEGMENT_INDEX_ENTRIES = 1024; // Rotated early when the index fills
+    static const size_t HISTORY_SAMPLE_BYTES = LOG_CHANNELS * sizeof(uint16_t) + sizeof(uint32_t) + sizeof(int64_t);
+    static const int HISTORY_MAX_CHANNELS = 16;         // Per /history request
+    static const uint32_t HISTORY_MAX_BUCKETS = 1000;
+    
+    // error_codes bits
+    static const uint8_t ERR_HIGH_TEMPERATURE = 0x01;   // Set by the program (%EB0)
+    static const uint8_t ERR_RUNG_BUDGET = 0x02;        // A rung overran its budget (latched)
+    static const uint8_t ERR_PROGRAM = 0x04;            // No valid program - controller in STOP
+    
+    // Periodic task classes, as on the TSX Premium. MAST is the main scan and
+    // owns the cycle counter and publication; FAST carries the I/O interlock
+    // rungs at a shorter period and always runs first when both are due.
+    enum TaskClass { TASK_MAST, TASK_FAST, TASK_COUNT };
+    
+    // Scan timing statistics - maintained by the scan thread and published
+    // together with the process image
+    struct ScanStats {
+        static const int BUCKETS = 8;
+        
+        uint64_t scans;
+        uint64_t overruns;          // Scans that ran past the next deadline
+        uint64_t missed_deadlines;  // Whole periods skipped after an overrun
+        uint32_t duration_min_us, duration_max_us;
+        uint64_t duration_sum_us;
+        uint32_t jitter_min_us, jitter_max_us;  // Wake-up lateness against the deadline
+        uint64_t jitter_sum_us;
+        uint64_t duration_histogram[BUCKETS];   // As wide as scans - one bucket can hold them all
+        uint64_t jitter_histogram[BUCKETS];
+        
+        ScanStats() { reset(); }
+        
+        void reset() {
+            memset(this, 0, sizeof(*this));
+            duration_min_us = jitter_min_us = UINT32_MAX;
+        }
+        
+        // Upper bound (exclusive) of each histogram bucket; the last is open-ended
+        static uint32_t bucket_limit_us(int bucket) {
+            static const uint32_t limits[BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2000, 5000 };
+            return bucket < BUCKETS - 1 ? limits[bucket] : UINT32_MAX;
+        }
+        
+        static int bucket_for(uint32_t us) {
+            int bucket = 0;
+            while (bucket < BUCKETS - 1 && us >= bucket_limit_us(bucket)) bucket++;
+            return bucket;
+        }
+        
+        void record(uint32_t duration_us, uint32_t jitter_us) {
+            scans++;
+            if (duration_us < duration_min_us) duration_min_us = duration_us;
+            if (duration_us > duration_max_us) duration_max_us = duration_us;
+            duration_sum_us += duration_us;
+            if (jitter_us < jitter_min_us) jitter_min_us = jitter_us;
+            if (jitter_us > jitter_max_us) jitter_max_us = jitter_us;
+            jitter_sum_us += jitter_us;
+            duration_histogram[bucket_for(duration_us)]++;
+            jitter_histogram[bucket_for(jitter_us)]++;
+        }
+    };
+    
+    // PLC State
+    struct SystemState {
+        bool running;
+        uint32_t cycle_count;
+        uint16_t inputs[MAX_INPUTS];
+        uint16_t outputs[MAX_OUTPUTS]; 
+        uint16_t registers[MAX_REGISTERS];
+        uint8_t discrete_inputs[MAX_DISCRETE_INPUTS / 8];   // Packed, LSB first
+        uint8_t discrete_outputs[MAX_DISCRETE_OUTPUTS / 8];
+        uint8_t error_codes;
+        char last_error[64];    // Fixed size - the state is copied whole each scan
+        ScanStats stats[TASK_COUNT];  // Task timing up to and including this scan
+        uint32_t rung_overruns;       // Rungs that exceeded the rung budget
+        uint32_t worst_rung_us;       // Longest timed rung and which one it was
+        uint32_t worst_rung;
+        
+        SystemState() : running(false), cycle_count(0), error_codes(0),
+                        rung_overruns(0), worst_rung_us(0), worst_rung(0) {
+            memset(inputs, 0, sizeof(inputs));
+            memset(outputs, 0, sizeof(outputs));
+            memset(registers, 0, sizeof(registers));
+            memset(discrete_inputs, 0, sizeof(discrete_inputs));
+            memset(discrete_outputs, 0, sizeof(discrete_outputs));
+            last_error[0] = '\0';
+        }
+    } state;                    // Owned by the scan thread
+    
+    // Compiled control program - a flat instruction array per task, operands
+    // resolved at load time to pointers into `state`, rungs delimited by
+    // OP_END_RUNG. Immutable once the scan thread starts.
+    enum Opcode {
+        OP_LD, OP_LDN, OP_ST, OP_STN, OP_S, OP_R,
+        OP_AND, OP_ANDN, OP_OR, OP_ORN, OP_XOR, OP_NOT,
+        OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD,
+        OP_GT, OP_GE, OP_EQ, OP_NE, OP_LE, OP_LT,
+        OP_MOVB, OP_GTB, OP_GEB, OP_EQB, OP_NEB, OP_LEB, OP_LTB,
+        OP_END_RUNG
+    };
+    
+    enum OperandKind { OPERAND_NONE, OPERAND_CONST, OPERAND_WORD, OPERAND_DWORD, OPERAND_BIT, OPERAND_BLOCK };
+    
+    struct Instruction {
+        uint8_t op;
+        uint8_t kind;
+        uint8_t mask;           // OPERAND_BIT
+        uint32_t rung;          // OP_END_RUNG: index into rung_labels
+        union {
+            int32_t value;      // OPERAND_CONST
+            uint16_t* word;
+            const uint32_t* dword;
+            uint8_t* bits;
+            uint32_t block;     // OPERAND_BLOCK: index into block_ops
+        };
+    };
+    
+    // Operands of a block instruction (MOVB, GTB, ...) - too many for an Instruction
+    struct BlockOp {
+        const uint16_t* src;
+        uint32_t count;
+        const uint16_t* limit;  // Compare limit register (nullptr = limit_value)
+        uint16_t limit_value;
+        uint16_t* dst;          // MOVB destination words
+        uint8_t* dst_bits;      // Compare destination - a discrete output bank
+        uint32_t dst_bit;
+    };
+    
+    std::vector<Instruction> program[TASK_COUNT];
+    std::vector<BlockOp> block_ops;
+    std::vector<std::string> rung_labels;
+    std::string program_name;
+    std::mutex program_lock;                // Held by a reload while it recompiles
+    std::atomic<bool> program_swapped;      // Scan thread picks up a reloaded program
+    
+    // Completed scans are handed to the other threads through lock-free
+    // triple buffers, one per reader, so no reader can ever stall the scan
+    TripleBuffer<SystemState> comm_channel;
+    TripleBuffer<SystemState> log_channel;
+    Notifier comm_wakeup;       // Registered with the reactor
+    Notifier* log_wakeup;       // Null when hosted - the host's log thread polls instead
+    
+    std::atomic<bool> running;
+    std::atomic<bool> logging;  // Logging thread - cleared only once the scan thread has exited
+    std::thread scan_thread;
+    std::thread log_thread;
+    bool hosted;                // Driven by a PLCHost instead of start()'s threads
+    
+    // Release schedule of one periodic task
+    struct TaskTimer {
+        int64_t period_ns;
+        int64_t deadline;       // Absolute CLOCK_MONOTONIC release time
+    };
+    TaskTimer timers[TASK_COUNT];
+    
+    // Virtual process - per instance, so hosted controllers evolve independently
+    SignalGenerator signals;
+    double sim_temperature;
+    double sim_pressure;
+    StopFileWatch stop_watch;   // Single controller only - a host watches for all
+    uint32_t last_displayed;    // Cycle of the last console status line
+    
+    // Network - Multi-protocol support
+    int server_socket;      // Control protocol (legacy ASCII)
+    int mgmt_socket;        // Management protocol (HTTP/JSON)
+    int modbus_socket;      // Modbus/TCP server
+    struct sockaddr_in server_addr;
+    struct sockaddr_in mgmt_addr;
+    
+    // Event-driven network servicing - listeners and accepted clients are
+    // handled as soon as epoll reports them ready, independent of the scan
+    enum Protocol { PROTO_CONTROL, PROTO_MANAGEMENT, PROTO_MODBUS };
+    
+    class Listener : public Reactor::Handler {
+    public:
+        Listener(LegacyPLC* owner, Protocol proto) : owner(owner), proto(proto) {}
+        void on_io_event(uint32_t /*events*/) override { owner->accept_clients(proto); }
+        bool urgent() const override { return proto != PROTO_MANAGEMENT; }
+    private:
+        LegacyPLC* owner;
+        Protocol proto;
+    };
+    
+    class ClientSession : public Reactor::Handler {
+    public:
+        ClientSession(LegacyPLC* owner, int fd, Protocol proto)
+            : owner(owner), fd(fd), proto(proto), events(EPOLLIN | EPOLLRDHUP), closing(false),
+              streaming(false), resync(false),
+              rx(proto == PROTO_CONTROL ? CONTROL_RX_CAPACITY : proto == PROTO_MODBUS ? MODBUS_RX_CAPACITY : MGMT_RX_CAPACITY),
+              tx(proto == PROTO_CONTROL ? CONTROL_TX_CAPACITY : proto == PROTO_MODBUS ? MODBUS_TX_CAPACITY : MGMT_TX_CAPACITY),
+              report_resync(false), tokens(0), refilled(0), throttled(false) {}
+        void on_io_event(uint32_t ready) override { owner->service_client(this, ready); }
+        void release() override { owner->recycle_session(this); }
+        bool urgent() const override { return proto != PROTO_MANAGEMENT; }
+        
+        // A pooled session taking a new connection
+        void reset(int client_fd) {
+            fd = client_fd;
+            events = EPOLLIN | EPOLLRDHUP;
+            closing = streaming = resync = report_resync = throttled = false;
+            rx.clear();
+            tx.clear();
+            subscription.clear();
+        }
+        
+        LegacyPLC* owner;
+        int fd;
+        Protocol proto;
+        uint32_t events;    // Interest set currently registered with the reactor
+        bool closing;       // Peer finished sending - close once replies are flushed
+        bool streaming;     // Subscribed to the /events push stream
+        bool resync;        // Stream fell behind - next event must be a full snapshot
+        SessionBuffer rx;   // Received bytes not yet framed into a command
+        SessionBuffer tx;   // Replies queued in request order, not yet sent
+        
+        // Control-port report-by-exception (SUB): points pushed as EVT lines
+        // when they move past their deadband from the value last reported
+        struct SubscribedPoint {
+            char type;          // I/O/R, as in the read commands
+            uint16_t address;
+            uint16_t point;     // Index into the per-scan change map
+            uint16_t deadband;
+            uint16_t reported;
+        };
+        std::vector<SubscribedPoint> subscription;
+        bool report_resync; // An EVT line was dropped - recheck every point
+        
+        // Request rate limit (--control-rate, --mgmt-rate): a token bucket
+        // holding one second of requests
+        uint32_t tokens;
+        int64_t refilled;   // monotonic_ns the bucket was last topped up
+        bool throttled;     // Out of tokens - reads paused until a scan publication
+    };
+    
+    class PublishListener : public Reactor::Handler {
+    public:
+        explicit PublishListener(LegacyPLC* owner) : owner(owner) {}
+        void on_io_event(uint32_t /*events*/) override { owner->on_state_published(); }
+        bool urgent() const override { return true; }     // Carries control-port SUB events
+    private:
+        LegacyPLC* owner;
+    };
+    
+    Reactor* own_reactor;       // Null when hosted - no epoll sets per instance
+    Reactor& reactor;
+    Listener control_listener;
+    Listener mgmt_listener;
+    Listener modbus_listener;
+    PublishListener publish_listener;
+    std::vector<ClientSession*> sessions;
+    // Closed sessions kept for the next connection, buffers and all, so
+    // connection churn neither grows nor fragments the heap. The lean build
+    // allocates its pool up front and keeps fewer.
+#ifdef MEMORY_CONSTRAINED
+    static const size_t IDLE_SESSIONS = 2;      // Per protocol
+#else
+    static const size_t IDLE_SESSIONS = 8;
+#endif
+    std::vector<ClientSession*> idle_sessions[3];
+    uint32_t open_sessions[3];                  // Per Protocol, against the client limits
+    std::vector<ClientSession*> throttled_sessions;
+    
+    // Status document serialized once per scan and shared by every management
+    // request until the next scan replaces it
+    struct StatusDocument {
+        uint32_t version;       // cycle_count the document was rendered for
+        size_t length;
+        char json[STATUS_JSON_CAPACITY];
+        
+        StatusDocument() : version(0), length(0) { json[0] = '\0'; }
+    } status_doc;
+    char http_body[MGMT_MAX_RESPONSE - 512];   // Scratch for dynamically built bodies
+    
+    // Server-Sent Events push stream - each scan's changes are rendered once
+    // and fanned out to every subscriber
+    SystemState streamed_state;         // Process image the last delta was taken against
+    uint32_t last_event_cycle;
+    char sse_event[SSE_EVENT_CAPACITY];
+    
+    // Points that changed in the last published scan - inputs, then
+    // outputs, then registers - shared by every SUB subscriber
+    static const uint32_t POINT_COUNT = MAX_INPUTS + MAX_OUTPUTS + MAX_REGISTERS;
+    uint32_t changed_points[(POINT_COUNT + 31) / 32];
+    
+    // Register writes from the network (ASCII WR/WRB, POST /registers,
+    // Modbus FC6/FC16), applied by the scan thread at the start of its next
+    // task run - one commit however many clients wrote, and no scan sees a
+    // block write half done. Writes to one address coalesce, the last value
+    // wins. The network fills one batch under write_lock while the scan
+    // applies the other.
+    struct WriteBatch {
+        uint16_t value[MAX_REGISTERS];
+        uint8_t dirty[MAX_REGISTERS];
+        uint16_t addresses[MAX_REGISTERS];  // Dirty addresses, in first-write order
+        uint32_t count;
+        
+        WriteBatch() : count(0) { memset(dirty, 0, sizeof(dirty)); }
+    };
+    std::mutex write_lock;
+    WriteBatch write_batches[2];
+    WriteBatch* pending_batch;      // Guarded by write_lock
+    WriteBatch* applying_batch;     // Scan thread only
+    std::atomic<uint32_t> register_writes;          // Accepted from the network
+    std::atomic<uint32_t> register_write_commits;   // Scan-boundary commits
+    
+    // /metrics instrumentation - see MetricCounter for the threading rules.
+    // Scan thread: phase timings. Communications thread: dispatch time,
+    // sessions and requests. Data log thread: batch write latency.
+    enum ScanPhase { PHASE_INPUTS, PHASE_LOGIC, PHASE_OUTPUTS, PHASE_COUNT };
+    enum RequestKind {
+        REQ_RI, REQ_RO, REQ_RR, REQ_RIB, REQ_ROB, REQ_RRB, REQ_RM, REQ_WR, REQ_WRB,
+        REQ_SUB, REQ_UNSUB, REQ_STATUS, REQ_INVALID,
+        REQ_MODBUS_FC1, REQ_MODBUS_FC2, REQ_MODBUS_FC3, REQ_MODBUS_FC4, REQ_MODBUS_FC6,
+        REQ_MODBUS_FC16, REQ_MODBUS_OTHER,
+        REQ_HTTP_GET, REQ_HTTP_HEAD, REQ_HTTP_POST, REQ_HTTP_OTHER,
+        REQ_COUNT
+    };
+    LatencyHistogram phase_latency[TASK_COUNT][PHASE_COUNT];
+    LatencyHistogram publish_latency;       // Publication (log_cycle_data phase), scan thread
+    LatencyHistogram network_latency;       // Socket and publication handling, excluding the wait
+    LatencyHistogram request_latency[REQ_COUNT];
+    LatencyHistogram log_write_latency;
+    MetricCounter sessions_accepted[3];     // Per Protocol
+    MetricCounter sessions_closed[3];
+    MetricCounter sessions_refused[3];      // Over the protocol's client limit
+    MetricCounter requests_throttled[3];    // Requests that waited for the rate limit
+    MetricCounter bytes_sent;
+    
+    // Phase tracing rings (GET /trace, SIGUSR1) - one per writer thread,
+    // recorded at the same points as the histograms above
+    enum TraceName {
+        TRACE_SCAN, TRACE_INPUTS, TRACE_LOGIC, TRACE_OUTPUTS, TRACE_PUBLISH, TRACE_OVERRUN,
+        TRACE_PUBLISHED, TRACE_SESSION, TRACE_ACCEPT, TRACE_CLOSE, TRACE_NAME_COUNT
+    };
+    TraceRing scan_trace;
+    TraceRing comm_trace;
+    
+    // Startup/runtime configuration
+    PLCConfig config;
+    
+    // Process-data log - every MAST scan, every point. The scan thread
+    // queues a fixed binary record; the logging thread batches them into
+    // large appends, as raw records, change-only delta records or CSV rows
+    // (PLC_LOG_FORMAT). Files are host byte order.
+    //   binary: LogFileHeader, then LogRecords back to back
+    //   delta:  DeltaLogHeader, then varint-length-framed records - see
+    //           encode_delta_record()
+    // Binary and delta streams are stored in preallocated, memory-mapped
+    // segment files (see SegmentHeader) that rotate by size and age; CSV
+    // segments are plain appended text.
+    struct LogFileHeader {
+        char magic[8];          // "PLCLOG1"
+        uint16_t record_size;
+        uint16_t inputs, outputs, registers;
+        uint32_t scan_period_ms;
+        uint32_t reserved;
+    };
+    
+    struct LogRecord {
+        uint32_t cycle;
+        uint8_t error_codes;
+        uint8_t reserved[3];
+        int64_t time_us;        // CLOCK_REALTIME at publication
+        uint16_t inputs[MAX_INPUTS];
+        uint16_t outputs[MAX_OUTPUTS];
+        uint16_t registers[MAX_REGISTERS];
+    };
+    
+    struct DeltaLogHeader {
+        LogFileHeader base;     // magic "PLCLOGD"
+        uint32_t keyframe_cycles;
+        uint16_t deadband[LOG_CHANNELS];
+        uint8_t analog[LOG_CHANNELS];   // 1 = XOR coded, 0 = delta coded
+    };
+    // Page after the stream header - 4096 unless the process image is enlarged
+    static const size_t SEGMENT_INDEX_OFFSET = (SEGMENT_STREAM_HEADER_OFFSET + sizeof(DeltaLogHeader) + 4095) / 4096 * 4096;
+    
+    // Reference values a delta record is coded against; the encoder and the
+    // decoder evolve identical copies
+    struct DeltaState {
+        bool primed;            // false until the first keyframe
+        uint32_t cycle;
+        uint32_t keyframe_cycle;
+        int64_t time_us;
+        int64_t interval_us;    // Previous record spacing (delta-of-delta time)
+        uint16_t value[LOG_CHANNELS];
+        uint8_t xor_lead[LOG_CHANNELS];     // Current XOR window per analog channel
+        uint8_t xor_bits[LOG_CHANNELS];     // 0 = no window yet
+    };
+    
+    // Segment file layout:
+    //   0                              SegmentHeader
+    //   SEGMENT_STREAM_HEADER_OFFSET   LogFileHeader / DeltaLogHeader
+    //   SEGMENT_INDEX_OFFSET           SegmentIndexEntry[index_capacity]
+    //   data_offset                    records, data_length bytes committed
+    // The header is only advanced after the records it covers are in the
+    // mapping, so a crash leaves a readable prefix.
+    struct SegmentHeader {
+        char magic[8];              // "PLCSEG1"
+        uint32_t format;            // PLCConfig::LogFormat of the records
+        uint32_t sequence;
+        uint32_t stream_header_size;
+        uint32_t index_capacity;
+        uint32_t index_count;       // Committed index entries
+        uint32_t closed;            // 1 once rotated out or shut down cleanly
+        uint64_t data_offset;
+        uint64_t data_capacity;
+        uint64_t data_length;
+        uint32_t first_cycle, last_cycle;
+        int64_t first_time_us, last_time_us;
+        int64_t created_us;
+    };
+    
+    // One entry per keyframe (delta) or per LOG_KEYFRAME_CYCLES (binary) -
+    // decoding can start at any entry's offset
+    struct SegmentIndexEntry {
+        uint32_t cycle;
+        uint32_t reserved;
+        uint64_t offset;            // Relative to data_offset
+        int64_t time_us;
+    };
+    
+    struct SegmentFile {
+        uint32_t sequence;
+        std::string path;
+        off_t size;
+        time_t modified;
+        bool operator<(const SegmentFile& other) const { return sequence < other.sequence; }
+    };
+    
+    SpscRing<LogRecord> log_ring;
+    DeltaLogHeader delta_header;
+    DeltaState delta_encoder;
+    std::string log_dir;
+    int log_fd;
+    uint32_t log_sequence;
+    char* segment_map;                  // nullptr for CSV segments
+    SegmentHeader* segment;
+    SegmentIndexEntry* segment_index;
+    size_t segment_size;                // Mapped size, or CSV bytes written
+    int64_t segment_opened;             // monotonic_ns
+    uint32_t index_pending;             // Entries written, committed with the next batch
+    uint32_t last_indexed_cycle;
+    bool segment_has_records;
+    uint32_t batch_last_cycle;
+    int64_t batch_last_time_us;
+    std::atomic<uint32_t> log_segment_current;
+    
+    // Recent scans for /history, struct-of-arrays: one column per log
+    // channel, so a query for a few points walks only those columns.
+    // Written by the logging thread; readers validate against history_head
+    // afterwards (seqlock style) instead of locking the writer out.
+    std::vector<uint16_t> history_values;   // [channel * history_capacity + slot]
+    std::vector<uint32_t> history_cycles;
+    std::vector<int64_t> history_times;     // time_us of each sample
+    uint32_t history_capacity;              // Power of two, 0 = disabled
+    std::atomic<uint32_t> history_head;     // Samples ever written
+    std::vector<char> large_body;           // GET /history and /trace - one reply is built at a time
+    std::vector<TraceRing::Event> trace_copy;
+    std::vector<char> log_batch;
+    size_t log_batch_used;
+    int64_t log_batch_started;          // monotonic_ns of the oldest unflushed sample
+    bool log_write_failed;
+    std::atomic<uint32_t> log_records_written;
+    std::atomic<uint32_t> log_records_dropped;  // Ring full - writer fell behind
+    std::atomic<uint32_t> log_batches_written;
+    std::atomic<uint32_t> log_bytes_written;
+    
+    // Retained memory for warm restarts (<log-dir>/plc_state.snap), mapped
+    // and written by the logging thread. Two slots, each checksummed: a save
+    // cut short by a crash leaves the previous slot to restore from.
+    struct SnapshotSlot {
+        uint32_t sequence;          // Saves so far (0 = never written)
+        uint32_t cycle_count;
+        int64_t time_us;            // Wall clock of the save
+        uint16_t outputs[MAX_OUTPUTS];
+        uint16_t registers[MAX_REGISTERS];
+        uint8_t discrete_outputs[MAX_DISCRETE_OUTPUTS / 8];
+        uint32_t checksum;          // FNV-1a of everything above
+    };
+    struct SnapshotFile {
+        char magic[8];              // "PLCSNAP1"
+        uint32_t layout[4];         // Image sizes it was saved with
+        SnapshotSlot slots[2];
+    };
+    SnapshotFile* snapshot;
+    int64_t snapshot_saved;         // monotonic_ns of the last save
+    
+public:
+    // shared_reactor: host mode - sockets are serviced by the host's reactor
+    // and the host's threads run the scan and the data log
+    explicit LegacyPLC(const PLCConfig& config = PLCConfig(), Reactor* shared_reactor = nullptr)
+                : program_swapped(false), log_wakeup(shared_reactor != nullptr ? nullptr : new Notifier()),
+                  running(false), logging(false), hosted(shared_reactor != nullptr),
+                  signals(static_cast<uint64_t>(config.sim_seed), static_cast<uint64_t>(config.port_offset)),
+                  sim_temperature(750.0), sim_pressure(500.0), last_displayed(0),
+                  server_socket(-1), mgmt_socket(-1), modbus_socket(-1),
+                  own_reactor(shared_reactor != nullptr ? nullptr : new Reactor()),
+                  reactor(shared_reactor != nullptr ? *shared_reactor : *own_reactor),
+                  control_listener(this, PROTO_CONTROL),
+                  mgmt_listener(this, PROTO_MANAGEMENT),
+                  modbus_listener(this, PROTO_MODBUS),
+                  publish_listener(this),
+                  last_event_cycle(0), pending_batch(&write_batches[0]), applying_batch(&write_batches[1]),
+                  register_writes(0), register_write_commits(0), config(config),
+                  log_ring(shared_reactor != nullptr ? HOSTED_LOG_RING_RECORDS : LOG_RING_RECORDS), log_fd(-1), log_sequence(0), segment_map(nullptr),
+                  segment(nullptr), segment_index(nullptr), segment_size(0), segment_opened(0),
+                  index_pending(0), last_indexed_cycle(0), segment_has_records(false),
+                  batch_last_cycle(0), batch_last_time_us(0), log_segment_current(0),
+                  history_capacity(0), history_head(0),
+                  log_batch(LOG_BATCH_BYTES),
+                  log_batch_used(0), log_batch_started(0), log_write_failed(false),
+                  log_records_written(0), log_records_dropped(0), log_batches_written(0),
+                  log_bytes_written(0), snapshot(nullptr), snapshot_saved(0) {
+        initialize_system();
+    }
+    
+    ~LegacyPLC() {
+        shutdown_system();
+        delete own_reactor;
+        delete log_wakeup;
+    }
+    
+    void initialize_system() {
+#ifdef VIRTUAL_HARDWARE
+        console.info("=== LEGACY PLC SIMULATOR v2.1 (VIRTUAL) ===");
+        console.info("Running in virtual cluster mode");
+        console.info("Hardware simulation: ENABLED");
+#elif defined(RASPBERRY_PI)
+        console.info("=== LEGACY PLC SIMULATOR v2.1 (RASPBERRY PI) ===");
+        #ifdef RPI_MODEL_B
+        console.info("Target: Raspberry Pi Model B");
+        #elif defined(RPI_MODEL_2_3)
+        console.info("Target: Raspberry Pi 2/3");
+        #elif defined(RPI_MODEL_4_5)
+        console.info("Target: Raspberry Pi 4/5");
+        #endif
+#else
+        console.info("=== LEGACY PLC SIMULATOR v2.1 ===");
+#endif
+        
+        console.info("Compatible with: Modicon, Allen-Bradley, Siemens");
+        console.info("Protocol: ASCII/TCP (Pre-OPC UA)");
+        if (config.fast_period_ms > 0) {
+            console.info("Scan Rate: %dms (FAST task: %dms)", config.scan_period_ms, config.fast_period_ms);
+        } else {
+            console.info("Scan Rate: %dms", config.scan_period_ms);
+        }
+        
+        // Initialize network
+        init_session_pool();
+        setup_network();
+        
+        // Initialize data logging (creates the log directory)
+        start_data_log();
+        init_history();
+        init_trace();
+        
+        // Load "ladder logic" simulation
+        load_control_program();
+        
+        // Warm restart: retained memory from the last snapshot, if any. The
+        // restored cycle is already in the data log - publish it without
+        // logging it again.
+        bool restored = restore_snapshot();
+        
+        state.running = program_loaded();
+        publish_state(!restored);
+        on_state_published();
+        reactor.add(comm_wakeup.fd(), EPOLLIN, &publish_listener);
+#ifdef VIRTUAL_HARDWARE
+        if (!hosted) stop_watch.start(reactor);
+#endif
+        
+        console.info("System initialized. Starting scan cycle...");
+    }
+    
+    void setup_network() {
+        console.info("Setting up multi-protocol industrial network...");
+        
+        // Setup control protocol (legacy ASCII)
+        setup_control_protocol();
+        
+        // Setup management protocol (HTTP/JSON)
+        setup_management_protocol();
+        
+        // Setup Modbus/TCP server
+        if (config.modbus_port > 0) setup_modbus_protocol();
+        
+        console.info("? Multi-protocol binding complete");
+    }
+    
+    // Listening ports - the build's base port plus the instance's offset
+    int control_port() const {
+#ifdef VIRTUAL_HARDWARE
+        return 9901 + config.port_offset;
+#else
+        return TCP_PORT + config.port_offset;
+#endif
+    }
+    
+    int modbus_port() const { return config.modbus_port + config.port_offset; }
+    
+    int management_port() const {
+#ifdef VIRTUAL_HARDWARE
+        return 8901 + config.port_offset;
+#else
+        return MGMT_PORT + config.port_offset;
+#endif
+    }
+    
+    void setup_control_protocol() {
+        server_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (server_socket < 0) {
+            console.error("Failed to create control socket");
+            return;
+        }
+        
+        // Make socket non-blocking for legacy-style polling
+        int flags = fcntl(server_socket, F_GETFL, 0);
+        fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
+        
+        // Reuse address
+        int opt = 1;
+        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        
+        server_addr.sin_family = AF_INET;
+        
+#ifdef VIRTUAL_HARDWARE
+        // Virtual mode - different port to avoid conflicts
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(control_port());
+        console.info("? Control Protocol: 0.0.0.0:%d (virtual - legacy ASCII)", control_port());
+#else
+        // Physical Pi - system-level binding (let infrastructure control access)
+        server_addr.sin_addr.s_addr = INADDR_ANY;  // Bind to all interfaces
+        server_addr.sin_port = htons(control_port());  // Port 9001
+        console.info("? Control Protocol: 0.0.0.0:%d (legacy ASCII - system-level binding)", control_port());
+        console.info("  Network access controlled by VLAN configuration");
+#endif
+        
+        if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+            console.error("Failed to bind control socket");
+            return;
+        }
+        
+        listen(server_socket, config.listen_backlog);
+        reactor.add(server_socket, EPOLLIN, &control_listener);
+    }
+    
+    void setup_management_protocol() {
+        mgmt_socket = socket(AF_INET, SOCK_STREAM, 0);
+        if (mgmt_socket < 0) {
+            console.error("Failed to create management socket");
+            return;
+        }
+        
+        // Make socket non-blocking
+        int flags = fcntl(mgmt_socket, F_GETFL, 0);
+        fcntl(mgmt_socket, F_SETFL, flags | O_NONBLOCK);
+        
+        // Reuse address
+        int opt = 1;
+        setsockopt(mgmt_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        
+        mgmt_addr.sin_family = AF_INET;
+        mgmt_addr.sin_addr.s_addr = INADDR_ANY;  // System-level binding
+        
+#ifdef VIRTUAL_HARDWARE
+        mgmt_addr.sin_port = htons(management_port());  // Different port for virtual
+        console.info("? Management Interface: 0.0.0.0:%d (virtual - HTTP/JSON)", management_port());
+#else
+        mgmt_addr.sin_port = htons(management_port());  // Port 8080
+        console.info("? Management Interface: 0.0.0.0:%d (HTTP/JSON status)", management_port());
+        console.info("  Accessible via management VLAN for monitoring/configuration");
+#endif
+        
+        if (bind(mgmt_socket, (struct sockaddr*)&mgmt_addr, sizeof(mgmt_addr)) < 0) {
+            console.error("Failed to bind management socket");
+            close(mgmt_socket);
+            mgmt_socket = -1;
+            return;
+        }
+        
+        listen(mgmt_socket, config.listen_backlog);  // Dashboards and historians connect in bursts
+        reactor.add(mgmt_socket, EPOLLIN, &mgmt_listener);
+    }
+    
+    void setup_modbus_protocol() {
+        modbus_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (modbus_socket < 0) {
+            console.error("Failed to create Modbus socket");
+            return;
+        }
+        int opt = 1;
+        setsockopt(modbus_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        
+        struct sockaddr_in modbus_addr;
+        memset(&modbus_addr, 0, sizeof(modbus_addr));
+        modbus_addr.sin_family = AF_INET;
+        modbus_addr.sin_addr.s_addr = INADDR_ANY;
+        modbus_addr.sin_port = htons(modbus_port());
+        if (bind(modbus_socket, (struct sockaddr*)&modbus_addr, sizeof(modbus_addr)) < 0) {
+            // Port 502 needs CAP_NET_BIND_SERVICE (AmbientCapabilities= in the unit file)
+            console.error("Failed to bind Modbus socket on port %d: %s", modbus_port(), strerror(errno));
+            close(modbus_socket);
+            modbus_socket = -1;
+            return;
+        }
+        console.info("? Modbus/TCP: 0.0.0.0:%d (holding registers = %%MW)", modbus_port());
+        
+        listen(modbus_socket, config.listen_backlog);   // SCADA masters and gateways reconnect in bursts
+        reactor.add(modbus_socket, EPOLLIN, &modbus_listener);
+    }
+    
+    void load_control_program() {
+        console.info("Loading control program...");
+        
+        // Initialize some default register values (typical configuration)
+        state.registers[0] = 100;   // Setpoint temperature
+        state.registers[1] = 50;    // Alarm threshold
+        state.registers[2] = 1000;  // Timer preset
+        state.registers[10] = 0x1234; // Device ID
+        
+        if (config.load_delay_ms > 0) {
+            // The original controller's program download time, for
+            // testing masters against a slow-starting node
+            usleep(config.load_delay_ms * 1000);
+        }
+        
+        program_name = config.program_path != nullptr ? config.program_path : "built-in";
+        std::string source;
+        bool loaded = read_program_source(&source) && compile_program(source.c_str());
+        
+        if (!loaded) {
+            // Fail safe: keep scanning I/O and serving the network in STOP,
+            // outputs held off, until a good program is installed
+            for (int t = 0; t < TASK_COUNT; t++) program[t].clear();
+            block_ops.clear();
+            rung_labels.clear();
+            state.error_codes |= ERR_PROGRAM;
+            snprintf(state.last_error, sizeof(state.last_error), "Program load failed");
+            console.error("Controller held in STOP - no valid program");
+            return;
+        }
+        
+        console.info("Program loaded (%s): %zu rungs, %zu instructions. Memory usage: %zuKB/%zuKB",
+                     program_name.c_str(), rung_labels.size(), program_instructions(),
+                     (program_bytes() + 1023) / 1024, PROGRAM_MEMORY / 1024);
+    }
+    
+    bool read_program_source(std::string* source) const {
+        if (config.program_path == nullptr) {
+            *source = DEFAULT_CONTROL_PROGRAM;
+            return true;
+        }
+        int fd = open(config.program_path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            console.error("Program error: cannot read %s", program_name.c_str());
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        source->assign(static_cast<size_t>(st.st_size), '\0');
+        size_t done = 0;
+        while (done < source->size()) {
+            ssize_t n = read(fd, &(*source)[done], source->size() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        close(fd);
+        source->resize(done);
+        return true;
+    }
+    
+    // SIGHUP (systemd ExecReload): recompile the program file and swap it in
+    // between task runs. Sockets, sessions and the process image are left
+    // alone; a program that does not compile leaves the running one in place.
+    // Runs on the communications thread, which is also the only other
+    // reader of the program tables (/scan).
+    void reload_program() {
+        std::string source;
+        if (!read_program_source(&source)) {
+            console.warning("Reload failed - keeping the running program");
+            return;
+        }
+        
+        std::lock_guard<std::mutex> lock(program_lock);
+        std::vector<Instruction> previous[TASK_COUNT];
+        std::vector<BlockOp> previous_blocks;
+        std::vector<std::string> previous_labels;
+        for (int t = 0; t < TASK_COUNT; t++) previous[t].swap(program[t]);
+        previous_blocks.swap(block_ops);
+        previous_labels.swap(rung_labels);
+        
+        if (!compile_program(source.c_str())) {
+            for (int t = 0; t < TASK_COUNT; t++) program[t].swap(previous[t]);
+            block_ops.swap(previous_blocks);
+            rung_labels.swap(previous_labels);
+            console.warning("Reload failed - keeping the running program");
+            return;
+        }
+        program_swapped.store(true, std::memory_order_release);
+        console.notice("Program reloaded (%s): %zu rungs, %zu instructions",
+                       program_name.c_str(), rung_labels.size(), program_instructions());
+    }
+    
+    bool program_loaded() const { return !rung_labels.empty(); }
+    
+    size_t program_instructions() const {
+        size_t total = 0;
+        for (int t = 0; t < TASK_COUNT; t++) total += program[t].size();
+        return total;
+    }
+    
+    size_t program_bytes() const {
+        return program_instructions() * sizeof(Instruction) + block_ops.size() * sizeof(BlockOp);
+    }
+    
+    // Compile IL source (see DEFAULT_CONTROL_PROGRAM for the dialect) into the
+    // per-task instruction arrays. Reports the first error with its line.
+    bool compile_program(const char* source) {
+        static const struct { const char* name; Opcode op; int operands; } OPCODES[] = {
+            {"LD", OP_LD, 1}, {"LDN", OP_LDN, 1}, {"ST", OP_ST, 1}, {"STN", OP_STN, 1},
+            {"S", OP_S, 1}, {"R", OP_R, 1}, {"AND", OP_AND, 1}, {"ANDN", OP_ANDN, 1},
+            {"OR", OP_OR, 1}, {"ORN", OP_ORN, 1}, {"XOR", OP_XOR, 1}, {"NOT", OP_NOT, 0},
+            {"ADD", OP_ADD, 1}, {"SUB", OP_SUB, 1}, {"MUL", OP_MUL, 1}, {"DIV", OP_DIV, 1},
+            {"MOD", OP_MOD, 1}, {"GT", OP_GT, 1}, {"GE", OP_GE, 1}, {"EQ", OP_EQ, 1},
+            {"NE", OP_NE, 1}, {"LE", OP_LE, 1}, {"LT", OP_LT, 1},
+            {"MOVB", OP_MOVB, 2}, {"GTB", OP_GTB, 3}, {"GEB", OP_GEB, 3}, {"EQB", OP_EQB, 3},
+            {"NEB", OP_NEB, 3}, {"LEB", OP_LEB, 3}, {"LTB", OP_LTB, 3},
+        };
+        
+        TaskClass task = TASK_MAST;
+        bool in_comment = false;
+        bool rung_open = false;
+        int rung_length = 0;
+        int line_no = 0;
+        char line[256];
+        
+        const char* p = source;
+        while (*p != '\0') {
+            // Next line, comments blanked out
+            line_no++;
+            size_t n = 0;
+            while (*p != '\0' && *p != '\n') {
+                if (in_comment) {
+                    if (p[0] == '*' && p[1] == ')') { in_comment = false; p++; }
+                } else if (p[0] == '(' && p[1] == '*') {
+                    in_comment = true;
+                    p++;
+                } else if (n < sizeof(line) - 1) {
+                    line[n++] = *p;
+                } else {
+                    return program_error(line_no, "line too long");
+                }
+                p++;
+            }
+            if (*p == '\n') p++;
+            line[n] = '\0';
+            
+            char word[32], operand[32], second[32], third[32], extra[32];
+            int fields = sscanf(line, "%31s %31s %31s %31s %31s", word, operand, second, third, extra);
+            if (fields <= 0) continue;
+            
+            if (strcasecmp(word, "TASK") == 0) {
+                if (fields != 2 || (strcasecmp(operand, "MAST") != 0 && strcasecmp(operand, "FAST") != 0)) {
+                    return program_error(line_no, "TASK must be MAST or FAST");
+                }
+                if (rung_open) close_rung(task);
+                rung_open = false;
+                task = strcasecmp(operand, "FAST") == 0 ? TASK_FAST : TASK_MAST;
+                continue;
+            }
+            if (strcasecmp(word, "RUNG") == 0) {
+                if (rung_open) close_rung(task);
+                rung_labels.push_back(fields >= 2 ? operand : std::to_string(rung_labels.size() + 1));
+                rung_open = true;
+                rung_length = 0;
+                continue;
+            }
+            
+            size_t i = 0;
+            const size_t opcode_count = sizeof(OPCODES) / sizeof(OPCODES[0]);
+            while (i < opcode_count && strcasecmp(word, OPCODES[i].name) != 0) i++;
+            if (i == opcode_count) return program_error(line_no, "unknown instruction");
+            if (fields != 1 + OPCODES[i].operands) {
+                return program_error(line_no, OPCODES[i].operands == 0 ? "unexpected operand" :
+                                              OPCODES[i].operands == 1 ? "expected one operand" :
+                                              OPCODES[i].operands == 2 ? "expected two operands" : "expected three operands");
+            }
+            
+            if (!rung_open) {
+                // Instructions before the first RUNG form an unnamed rung
+                rung_labels.push_back(std::to_string(rung_labels.size() + 1));
+                rung_open = true;
+                rung_length = 0;
+            }
+            if (rung_length == 0 && OPCODES[i].op != OP_LD && OPCODES[i].op != OP_LDN) {
+                return program_error(line_no, "rung must start with LD or LDN");
+            }
+            if (++rung_length > MAX_RUNG_INSTRUCTIONS) return program_error(line_no, "rung too long");
+            
+            Instruction in;
+            memset(&in, 0, sizeof(in));
+            in.op = OPCODES[i].op;
+            in.kind = OPERAND_NONE;
+            if (OPCODES[i].operands > 1) {
+                const char* error = resolve_block(in.op, operand, second, third, in);
+                if (error != nullptr) return program_error(line_no, error);
+            } else if (OPCODES[i].operands == 1 && !resolve_operand(operand, in)) {
+                return program_error(line_no, "invalid operand");
+            }
+            bool writes = in.op == OP_ST || in.op == OP_STN || in.op == OP_S || in.op == OP_R;
+            if (writes && !operand_writable(in)) {
+                return program_error(line_no, "operand is read-only");
+            }
+            program[task].push_back(in);
+            
+            if (program_bytes() > PROGRAM_MEMORY) return program_error(line_no, "program exceeds controller memory");
+        }
+        if (in_comment) return program_error(line_no, "unterminated comment");
+        if (rung_open) close_rung(task);
+        if (!program_loaded()) return program_error(line_no, "program has no rungs");
+        return true;
+    }
+    
+    void close_rung(TaskClass task) {
+        Instruction end;
+        memset(&end, 0, sizeof(end));
+        end.op = OP_END_RUNG;
+        end.kind = OPERAND_NONE;
+        end.rung = static_cast<uint32_t>(rung_labels.size() - 1);
+        program[task].push_back(end);
+    }
+    
+    bool program_error(int line_no, const char* message) {
+        console.error("Program error: %s:%d: %s", program_name.c_str(), line_no, message);
+        return false;
+    }
+    
+    bool operand_writable(const Instruction& in) const {
+        if (in.kind == OPERAND_BIT) {
+            return in.bits < state.discrete_inputs || in.bits >= state.discrete_inputs + sizeof(state.discrete_inputs);
+        }
+        return in.kind == OPERAND_WORD && (in.word < state.inputs || in.word >= state.inputs + MAX_INPUTS);
+    }
+    
+    // Word table an operand resolved into, as [first, end)
+    void word_table(const uint16_t* word, const uint16_t** first, const uint16_t** end) const {
+        if (word >= state.inputs && word < state.inputs + MAX_INPUTS) {
+            *first = state.inputs; *end = state.inputs + MAX_INPUTS;
+        } else if (word >= state.outputs && word < state.outputs + MAX_OUTPUTS) {
+            *first = state.outputs; *end = state.outputs + MAX_OUTPUTS;
+        } else {
+            *first = state.registers; *end = state.registers + MAX_REGISTERS;
+        }
+    }
+    
+    // Operands of MOVB src:n dst and of the block compares src:n limit %QX<m>.
+    // Returns nullptr, or what is wrong with them.
+    const char* resolve_block(uint8_t op, const char* source, const char* second, const char* third,
+                              Instruction& in) {
+        BlockOp block;
+        memset(&block, 0, sizeof(block));
+        
+        const char* colon = strchr(source, ':');
+        char first[32];
+        if (colon == nullptr || static_cast<size_t>(colon - source) >= sizeof(first)) return "expected a block src:n";
+        memcpy(first, source, colon - source);
+        first[colon - source] = '\0';
+        Instruction src;
+        const char* p = colon + 1;
+        const char* end = source + strlen(source);
+        if (!resolve_operand(first, src) || src.kind != OPERAND_WORD ||
+            !parse_uint(p, end, &block.count) || p != end || block.count == 0) {
+            return "invalid block";
+        }
+        const uint16_t *table, *table_end;
+        word_table(src.word, &table, &table_end);
+        if (block.count > static_cast<uint32_t>(table_end - src.word)) return "block runs past the end of its table";
+        block.src = src.word;
+        
+        Instruction target;
+        if (op == OP_MOVB) {
+            if (!resolve_operand(second, target) || target.kind != OPERAND_WORD) return "invalid operand";
+            if (!operand_writable(target)) return "operand is read-only";
+            word_table(target.word, &table, &table_end);
+            if (block.count > static_cast<uint32_t>(table_end - target.word)) return "block runs past the end of its table";
+            block.dst = target.word;
+        } else {
+            Instruction limit;
+            if (!resolve_operand(second, limit) ||
+                (limit.kind != OPERAND_WORD && (limit.kind != OPERAND_CONST || limit.value < 0))) {
+                return "limit must be a word or a constant";
+            }
+            if (limit.kind == OPERAND_WORD) block.limit = limit.word;
+            else block.limit_value = static_cast<uint16_t>(limit.value);
+            
+            if (!resolve_operand(third, target) || target.kind != OPERAND_BIT ||
+                target.bits < state.discrete_outputs ||
+                target.bits >= state.discrete_outputs + sizeof(state.discrete_outputs)) {
+                return "compare results go to %QX";
+            }
+            block.dst_bits = state.discrete_outputs;
+            block.dst_bit = static_cast<uint32_t>(target.bits - state.discrete_outputs) * 8 + __builtin_ctz(target.mask);
+            if (block.count > MAX_DISCRETE_OUTPUTS - block.dst_bit) return "block runs past the end of %QX";
+        }
+        
+        in.kind = OPERAND_BLOCK;
+        in.block = static_cast<uint32_t>(block_ops.size());
+        block_ops.push_back(block);
+        return nullptr;
+    }
+    
+    // %I<n>, %Q<n>, %MW<n>, %IX<n>, %QX<n>, %EB<n>, %SD0, or a decimal / 16#hex constant
+    bool resolve_operand(const char* text, Instruction& in) {
+        const char* end = text + strlen(text);
+        uint32_t index;
+        if (text[0] != '%') {
+            const char* p = text;
+            bool negative = (*p == '-');
+            if (negative) p++;
+            int base = 10;
+            if (strncmp(p, "16#", 3) == 0) { base = 16; p += 3; }
+            char* stop = nullptr;
+            long value = strtol(p, &stop, base);
+            if (stop == p || *stop != '\0' || value > 65535) return false;
+            in.kind = OPERAND_CONST;
+            in.value = static_cast<int32_t>(negative ? -value : value);
+            return true;
+        }
+        
+        const char* p = text + 1;
+        int space;      // 0 = I, 1 = Q, 2 = MW, 3 = EB, 4 = SD, 5 = IX, 6 = QX
+        if (strncasecmp(p, "MW", 2) == 0) { space = 2; p += 2; }
+        else if (strncasecmp(p, "EB", 2) == 0) { space = 3; p += 2; }
+        else if (strncasecmp(p, "SD", 2) == 0) { space = 4; p += 2; }
+        else if (strncasecmp(p, "IX", 2) == 0) { space = 5; p += 2; }
+        else if (strncasecmp(p, "QX", 2) == 0) { space = 6; p += 2; }
+        else if (*p == 'I' || *p == 'i') { space = 0; p++; }
+        else if (*p == 'Q' || *p == 'q') { space = 1; p++; }
+        else return false;
+        if (!parse_uint(p, end, &index) || p != end) return false;
+        
+        switch (space) {
+            case 0:
+                if (index >= static_cast<uint32_t>(MAX_INPUTS)) return false;
+                in.kind = OPERAND_WORD;
+                in.word = &state.inputs[index];
+                return true;
+            case 1:
+                if (index >= static_cast<uint32_t>(MAX_OUTPUTS)) return false;
+                in.kind = OPERAND_WORD;
+                in.word = &state.outputs[index];
+                return true;
+            case 2:
+                if (index >= static_cast<uint32_t>(MAX_REGISTERS)) return false;
+                in.kind = OPERAND_WORD;
+                in.word = &state.registers[index];
+                return true;
+            case 3:
+                if (index >= 8) return false;
+                in.kind = OPERAND_BIT;
+                in.bits = &state.error_codes;
+                in.mask = static_cast<uint8_t>(1u << index);
+                return true;
+            case 5:
+            case 6: {
+                uint8_t* bank = space == 5 ? state.discrete_inputs : state.discrete_outputs;
+                if (index >= static_cast<uint32_t>(space == 5 ? MAX_DISCRETE_INPUTS : MAX_DISCRETE_OUTPUTS)) return false;
+                in.kind = OPERAND_BIT;
+                in.bits = bank + index / 8;
+                in.mask = static_cast<uint8_t>(1u << (index % 8));
+                return true;
+            }
+            default:
+                if (index != 0) return false;
+                in.kind = OPERAND_DWORD;
+                in.dword = &state.cycle_count;
+                return true;
+        }
+    }
+    
+    static inline int64_t load_operand(const Instruction& in) {
+        switch (in.kind) {
+            case OPERAND_WORD:  return *in.word;
+            case OPERAND_BIT:   return (*in.bits & in.mask) != 0;
+            case OPERAND_DWORD: return *in.dword;
+            default:            return in.value;
+        }
+    }
+    
+    static inline void store_operand(const Instruction& in, int64_t value) {
+        if (in.kind == OPERAND_WORD) {
+            *in.word = static_cast<uint16_t>(value);
+        } else if (value != 0) {
+            *in.bits |= in.mask;
+        } else {
+            *in.bits &= static_cast<uint8_t>(~in.mask);
+        }
+    }
+    
+    // Interpreter - one pass over a task's instruction array. Rungs are only
+    // timed when a rung budget is configured.
+    void execute_program(TaskClass task) {
+        const std::vector<Instruction>& code = program[task];
+        if (code.empty()) return;
+        
+        const int64_t budget_ns = static_cast<int64_t>(config.rung_budget_us) * 1000;
+        int64_t rung_start = budget_ns > 0 ? monotonic_ns() : 0;
+        int64_t cr = 0;         // Current result
+        
+        for (const Instruction* in = &code[0], *end = in + code.size(); in != end; ++in) {
+            switch (in->op) {
+                case OP_LD:   cr = load_operand(*in); break;
+                case OP_LDN:  cr = load_operand(*in) == 0; break;
+                case OP_ST:   store_operand(*in, cr); break;
+                case OP_STN:  store_operand(*in, cr == 0); break;
+                case OP_S:    if (cr != 0) store_operand(*in, 1); break;
+                case OP_R:    if (cr != 0) store_operand(*in, 0); break;
+                case OP_AND:  cr = (cr != 0) && load_operand(*in) != 0; break;
+                case OP_ANDN: cr = (cr != 0) && load_operand(*in) == 0; break;
+                case OP_OR:   cr = (cr != 0) || load_operand(*in) != 0; break;
+                case OP_ORN:  cr = (cr != 0) || load_operand(*in) == 0; break;
+                case OP_XOR:  cr = (cr != 0) != (load_operand(*in) != 0); break;
+                case OP_NOT:  cr = cr == 0; break;
+                case OP_ADD:  cr += load_operand(*in); break;
+                case OP_SUB:  cr -= load_operand(*in); break;
+                case OP_MUL:  cr *= load_operand(*in); break;
+                case OP_DIV:  { int64_t v = load_operand(*in); cr = v != 0 ? cr / v : 0; } break;
+                case OP_MOD:  { int64_t v = load_operand(*in); cr = v != 0 ? cr % v : 0; } break;
+                case OP_GT:   cr = cr >  load_operand(*in); break;
+                case OP_GE:   cr = cr >= load_operand(*in); break;
+                case OP_EQ:   cr = cr == load_operand(*in); break;
+                case OP_NE:   cr = cr != load_operand(*in); break;
+                case OP_LE:   cr = cr <= load_operand(*in); break;
+                case OP_LT:   cr = cr <  load_operand(*in); break;
+                case OP_MOVB: if (cr != 0) move_block(block_ops[in->block]); break;
+                case OP_GTB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_GT, false); break;
+                case OP_GEB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_LT, true); break;
+                case OP_EQB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_EQ, false); break;
+                case OP_NEB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_EQ, true); break;
+                case OP_LEB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_GT, true); break;
+                case OP_LTB:  if (cr != 0) cr = compare_block(block_ops[in->block], BlockKernels::CMP_LT, false); break;
+                case OP_END_RUNG:
+                    if (budget_ns > 0) {
+                        int64_t now = monotonic_ns();
+                        check_rung_budget(in->rung, now - rung_start, budget_ns);
+                        rung_start = now;
+                    }
+                    break;
+            }
+        }
+    }
+    
+    // libc's memmove is already vectorized for the CPU it runs on - source
+    // and destination may overlap when both are in the same table
+    static inline void move_block(const BlockOp& block) {
+        memmove(block.dst, block.src, block.count * sizeof(uint16_t));
+    }
+    
+    static inline bool compare_block(const BlockOp& block, BlockKernels::Compare op, bool invert) {
+        uint16_t limit = block.limit != nullptr ? *block.limit : block.limit_value;
+        return BlockKernels::compare(block.src, block.count, limit, op, invert, block.dst_bits, block.dst_bit);
+    }
+    
+    void check_rung_budget(uint32_t rung, int64_t elapsed_ns, int64_t budget_ns) {
+        uint32_t elapsed_us = static_cast<uint32_t>(elapsed_ns / 1000);
+        if (elapsed_us > state.worst_rung_us) {
+            state.worst_rung_us = elapsed_us;
+            state.worst_rung = rung;
+        }
+        if (elapsed_ns > budget_ns) {
+            state.rung_overruns++;
+            state.error_codes |= ERR_RUNG_BUDGET;
+            snprintf(state.last_error, sizeof(state.last_error), "Rung %s over budget (%uus)",
+                     rung_labels[rung].c_str(), elapsed_us);
+        }
+    }
+    
+    bool fast_task_enabled() const { return config.fast_period_ms > 0; }
+    
+    // One execution of a task's section of each scan phase
+    void run_task(TaskClass task) {
+        int64_t started = monotonic_ns();
+        LatencyHistogram* phases = phase_latency[task];
+        
+        // Writes received since the last task run, all at once
+        apply_register_writes();
+        
+        // Input scan phase
+        scan_inputs(task);
+        int64_t scanned = monotonic_ns();
+        phases[PHASE_INPUTS].record(started, scanned);
+        scan_trace.record(TRACE_INPUTS, task, started, scanned);
+        
+        // Program execution phase - skipped, I/O still scanned, for the one
+        // task run a reload may overlap rather than waiting for it
+        std::unique_lock<std::mutex> program_guard(program_lock, std::try_to_lock);
+        if (program_guard.owns_lock()) {
+            if (program_swapped.load(std::memory_order_acquire)) adopt_reloaded_program();
+            execute_control_logic(task);
+        }
+        program_guard.unlock();
+        int64_t executed = monotonic_ns();
+        phases[PHASE_LOGIC].record(scanned, executed);
+        scan_trace.record(TRACE_LOGIC, task, scanned, executed);
+        
+        // Output update phase  
+        update_outputs(task);
+        int64_t updated = monotonic_ns();
+        phases[PHASE_OUTPUTS].record(executed, updated);
+        scan_trace.record(TRACE_OUTPUTS, task, executed, updated);
+    }
+    
+    void run_scan_cycle() {
+        // Without a FAST task its section runs at the head of every MAST scan,
+        // which is exactly the original single-rate program order
+        if (!fast_task_enabled()) {
+            run_task(TASK_FAST);
+        }
+        run_task(TASK_MAST);
+        
+        state.cycle_count++;
+    }
+    
+    void publish_state(bool log_record = true) {
+        int64_t started = monotonic_ns();
+        if (log_record) queue_log_record();
+        
+        comm_channel.write_slot() = state;
+        comm_channel.publish();
+        comm_wakeup.signal();
+        
+        log_channel.write_slot() = state;
+        log_channel.publish();
+        if (log_wakeup != nullptr) log_wakeup->signal();
+        int64_t finished = monotonic_ns();
+        publish_latency.record(started, finished);
+        scan_trace.record(TRACE_PUBLISH, TASK_MAST, started, finished);
+    }
+    
+    // Scan thread - nothing but the scan runs here. Tasks are released on
+    // absolute deadlines (deadline += period), so neither sleep overshoot nor
+    // scan duration accumulates into drift. There is no preemption: a FAST
+    // release that falls inside a long MAST scan is serviced as soon as it ends.
+    void scan_loop() {
+        apply_realtime_settings(config.rt_priority, config.cpu);
+        
+        int64_t wake = arm_task_timers();
+        while (running.load(std::memory_order_acquire)) {
+            sleep_until(wake);
+            wake = run_released_tasks();
+        }
+    }
+    
+    // Scan scheduling, also driven by the host's ScanExecutor: arm both
+    // timers one period (plus phase_ns) from now, then call
+    // run_released_tasks() at each returned time
+    int64_t arm_task_timers(int64_t phase_ns = 0) {
+        if (hosted) running.store(true, std::memory_order_release);
+        int64_t start = monotonic_ns() + phase_ns;
+        timers[TASK_MAST].period_ns = static_cast<int64_t>(config.scan_period_ms) * 1000000LL;
+        timers[TASK_FAST].period_ns = static_cast<int64_t>(config.fast_period_ms) * 1000000LL;
+        timers[TASK_MAST].deadline = start + timers[TASK_MAST].period_ns;
+        timers[TASK_FAST].deadline = start + timers[TASK_FAST].period_ns;
+        return next_release();
+    }
+    
+    // Run every task that is due - FAST first - and return the next release
+    int64_t run_released_tasks() {
+        if (fast_task_enabled() && monotonic_ns() >= timers[TASK_FAST].deadline) {
+            run_timed(TASK_FAST, timers[TASK_FAST]);
+        }
+        if (monotonic_ns() >= timers[TASK_MAST].deadline) {
+            run_timed(TASK_MAST, timers[TASK_MAST]);
+            
+            // Publication phase - hand the completed image to communications
+            // and logging; neither can block or tear it
+            publish_state();
+        }
+        return next_release();
+    }
+    
+    // Relative deadline of a released job - the next release of its
+    // shortest-period task
+    int64_t shortest_period_ns() const {
+        int ms = fast_task_enabled() ? config.fast_period_ms : config.scan_period_ms;
+        return static_cast<int64_t>(ms) * 1000000LL;
+    }
+    
+    int64_t next_release() const {
+        int64_t wake = timers[TASK_MAST].deadline;
+        if (fast_task_enabled() && timers[TASK_FAST].deadline < wake) {
+            wake = timers[TASK_FAST].deadline;
+        }
+        return wake;
+    }
+    
+    // Run a released task, record its timing and schedule its next release
+    void run_timed(TaskClass task, TaskTimer& timer) {
+        int64_t started = monotonic_ns();
+        if (task == TASK_MAST) {
+            run_scan_cycle();
+        } else {
+            run_task(task);
+        }
+        int64_t finished = monotonic_ns();
+        scan_trace.record(TRACE_SCAN, task, started, finished);
+        
+        ScanStats& stats = state.stats[task];
+        stats.record(static_cast<uint32_t>((finished - started) / 1000),
+                     static_cast<uint32_t>((started - timer.deadline) / 1000));
+        
+        timer.deadline += timer.period_ns;
+        if (finished > timer.deadline) {
+            // Overrun - drop the periods already lost instead of bursting
+            // through them, keeping the original phase
+            int64_t missed = (finished - timer.deadline) / timer.period_ns + 1;
+            scan_trace.record(TRACE_OVERRUN, task, finished, finished);
+            stats.overruns++;
+            stats.missed_deadlines += missed;
+            timer.deadline += missed * timer.period_ns;
+        }
+    }
+    
+    // Optional SCHED_FIFO priority and CPU pinning for the calling scan
+    // thread - needs CAP_SYS_NICE (or LimitRTPRIO=) and a multi-core Pi to
+    // be worthwhile
+    static void apply_realtime_settings(int rt_priority, int cpu) {
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+                console.warning("Warning: cannot pin scan thread to CPU %d", cpu);
+            } else {
+                console.info("? Scan thread pinned to CPU %d", cpu);
+            }
+        }
+        
+        if (rt_priority > 0) {
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = rt_priority;
+            if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+                console.warning("Warning: SCHED_FIFO priority %d not permitted - running with normal scheduling",
+                                rt_priority);
+            } else {
+                console.info("? Scan thread running SCHED_FIFO priority %d", rt_priority);
+            }
+        }
+    }
+    
+    // Communications side of a published scan: serialize the management
+    // document once and push the scan's changes to /events subscribers
+    void on_state_published() {
+        int64_t started = monotonic_ns();
+        comm_wakeup.clear();
+        if (comm_channel.update()) {
+            render_status_document();
+            publish_scan_events();
+        }
+        resume_throttled_sessions();
+        int64_t finished = monotonic_ns();
+        network_latency.record(started, finished);
+        comm_trace.record(TRACE_PUBLISHED, 0, started, finished);
+    }
+    
+    // Input scan phase. FAST reads the signals its interlock rungs act on
+    // (temperature, run enable); MAST reads the rest.
+    void scan_inputs(TaskClass task) {
+        // Simulate input scanning with enhanced virtual behavior
+        
+#ifdef VIRTUAL_HARDWARE
+        // More realistic simulation for virtual cluster testing
+        const uint32_t cycle_input_period = 200;
+        
+        if (task == TASK_FAST) {
+            // Temperature with more complex behavior in virtual mode:
+            // sin(cycle * 0.1 rad) swing plus noise
+            static const uint32_t TEMPERATURE_PHASE_STEP = static_cast<uint32_t>(0.1 / (2 * M_PI) * 4294967296.0 + 0.5);
+            sim_temperature += SignalGenerator::sine(state.cycle_count * TEMPERATURE_PHASE_STEP) * 2 +
+                               signals.between(-10, 9) * 0.1;
+            if (sim_temperature < 600) sim_temperature = 600;
+            if (sim_temperature > 900) sim_temperature = 900;
+            state.inputs[0] = static_cast<uint16_t>(sim_temperature);
+            
+            // Always-on input (run enable) - off while the virtual control file exists
+            state.inputs[2] = StopFileWatch::present() ? 0 : 1;
+        } else {
+            // Pressure with virtual drift
+            sim_pressure += signals.between(-3, 2); // Random walk
+            if (sim_pressure < 400) sim_pressure = 400;
+            if (sim_pressure > 600) sim_pressure = 600;
+            state.inputs[3] = static_cast<uint16_t>(sim_pressure);
+            
+            // Cycle input with configurable period in virtual mode  
+            state.inputs[1] = (state.cycle_count % cycle_input_period < cycle_input_period / 2) ? 1 : 0;
+        }
+        
+#else
+        // Original simulation for hardware builds
+        if (task == TASK_FAST) {
+            state.inputs[0] = static_cast<uint16_t>(750 + signals.uniform(100)); // Temperature sensor (raw ADC)
+            state.inputs[2] = 1; // Always-on input (run enable)
+        } else {
+            state.inputs[1] = (state.cycle_count % 200 < 100) ? 1 : 0; // Cycle input
+            
+            // Simulate pressure sensor with drift
+            sim_pressure += signals.between(-1, 1); // Random walk
+            state.inputs[3] = static_cast<uint16_t>(sim_pressure);
+        }
+#endif
+        if (task == TASK_MAST) scan_field_inputs();
+    }
+    
+    // Points only a -DPLC_MAX_INPUTS build has: a triangle ramp per channel,
+    // phase shifted so block compares over a large field see values cross
+    // their limits. The discrete bank counts in binary, one byte per scan.
+    void scan_field_inputs() {
+        for (int i = LEGACY_INPUTS; i < MAX_INPUTS; i++) {
+            uint32_t phase = (state.cycle_count + i * 37) % 2000;
+            state.inputs[i] = static_cast<uint16_t>(phase < 1000 ? phase : 2000 - phase);
+        }
+        for (size_t i = 0; i < sizeof(state.discrete_inputs); i++) {
+            state.discrete_inputs[i] = static_cast<uint8_t>((state.cycle_count >> 3) + i);
+        }
+    }
+    
+    // Never blocks the scan - if the network thread holds the batch, its
+    // writes simply wait for the next task run
+    void apply_register_writes() {
+        WriteBatch* batch;
+        {
+            std::unique_lock<std::mutex> lock(write_lock, std::try_to_lock);
+            if (!lock.owns_lock() || pending_batch->count == 0) return;
+            batch = pending_batch;
+            pending_batch = applying_batch;     // Emptied by the previous commit
+            applying_batch = batch;
+        }
+        for (uint32_t i = 0; i < batch->count; i++) {
+            uint16_t address = batch->addresses[i];
+            state.registers[address] = batch->value[address];
+            batch->dirty[address] = 0;
+        }
+        batch->count = 0;
+        register_write_commits.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    // A good program leaves STOP; rung statistics restart with it
+    void adopt_reloaded_program() {
+        program_swapped.store(false, std::memory_order_relaxed);
+        state.running = true;
+        state.error_codes &= ~ERR_PROGRAM;
+        state.worst_rung = 0;
+        state.worst_rung_us = 0;
+    }
+    
+    void execute_control_logic(TaskClass task) {
+        // Ladder logic as compiled from the IL program; nothing runs in STOP
+        if (!state.running) return;
+        execute_program(task);
+    }
+    
+    void update_outputs(TaskClass task) {
+        // In real PLC, this would update physical outputs
+        // Here we just ensure internal consistency
+        if (task != TASK_FAST) return;
+        
+        // Update some computed registers
+        state.registers[100] = state.inputs[0];  // Copy temperature to register
+        state.registers[101] = state.outputs[0]; // Copy heater status
+    }
+    
+    void handle_network_communication(int timeout_ms) {
+        // Service every ready socket (both protocols) and every scan published
+        // in the meantime; returns no later than timeout_ms
+        reactor.poll(timeout_ms);
+    }
+    
+    // Newest completed scan as seen by communications - stable until the
+    // reactor picks up the next publication
+    const SystemState& published() const { return comm_channel.read_slot(); }
+    
+    void accept_clients(Protocol proto) {
+        int listen_fd = proto == PROTO_CONTROL ? server_socket : proto == PROTO_MODBUS ? modbus_socket : mgmt_socket;
+        if (listen_fd < 0) return;
+        
+        // Drain the whole accept backlog - a burst no longer waits a scan per client
+        while (true) {
+            int client_socket = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client_socket < 0) {
+                if (errno == EINTR) continue;
+                return; // EAGAIN (backlog empty) or transient error
+            }
+            
+            if (open_sessions[proto] >= client_limit(proto)) {
+                refuse_client(client_socket, proto);
+                continue;
+            }
+            ClientSession* session = acquire_session(client_socket, proto);
+            if (!reactor.add(client_socket, session->events, session)) {
+                close(client_socket);
+                recycle_session(session);
+                continue;
+            }
+            sessions.push_back(session);
+            open_sessions[proto]++;
+            sessions_accepted[proto].add(1);
+            if (comm_trace.enabled()) {
+                int64_t now = monotonic_ns();
+                comm_trace.record(TRACE_ACCEPT, static_cast<uint16_t>(client_socket), now, now);
+            }
+        }
+    }
+    
+    uint32_t client_limit(Protocol proto) const {
+        return static_cast<uint32_t>(proto == PROTO_MANAGEMENT ? config.max_mgmt_clients : config.max_control_clients);
+    }
+    
+    int request_rate(Protocol proto) const {
+        return proto == PROTO_MANAGEMENT ? config.mgmt_rate : config.control_rate;
+    }
+    
+    // Over the client limit: say so where the protocol has a way to, then
+    // close - a refused client retries instead of hanging in the backlog
+    void refuse_client(int client_fd, Protocol proto) {
+        static const char CONTROL_BUSY[] = "ERR9\r\n";
+        static const char HTTP_BUSY[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n"
+                                        "Content-Length: 0\r\nConnection: close\r\n\r\n";
+        ssize_t ignored = 0;
+        if (proto == PROTO_CONTROL) {
+            ignored = send(client_fd, CONTROL_BUSY, sizeof(CONTROL_BUSY) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        } else if (proto == PROTO_MANAGEMENT) {
+            ignored = send(client_fd, HTTP_BUSY, sizeof(HTTP_BUSY) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        (void)ignored;
+        close(client_fd);
+        sessions_refused[proto].add(1);
+    }
+    
+    ClientSession* acquire_session(int client_fd, Protocol proto) {
+        std::vector<ClientSession*>& idle = idle_sessions[proto];
+        ClientSession* session;
+        if (idle.empty()) {
+            session = new ClientSession(this, client_fd, proto);
+        } else {
+            session = idle.back();
+            idle.pop_back();
+            session->reset(client_fd);
+        }
+        session->tokens = static_cast<uint32_t>(request_rate(proto));
+        session->refilled = monotonic_ns();
+        return session;
+    }
+    
+    // One request's worth of the session's rate limit. An over-rate client
+    // is not failed: its requests wait in the receive buffer, reading pauses
+    // so TCP pushes back on it, and the next scan publication resumes it.
+    bool admit_request(ClientSession* session) {
+        int rate = request_rate(session->proto);
+        if (rate <= 0) return true;
+        if (session->tokens == 0) {
+            int64_t now = monotonic_ns();
+            int64_t earned = (now - session->refilled) * rate / 1000000000LL;
+            if (earned <= 0) {
+                if (!session->throttled) {
+                    session->throttled = true;
+                    throttled_sessions.push_back(session);
+                    requests_throttled[session->proto].add(1);
+                }
+                return false;
+            }
+            session->tokens = static_cast<uint32_t>(std::min<int64_t>(earned, rate));
+            session->refilled = earned >= rate ? now : session->refilled + earned * 1000000000LL / rate;
+        }
+        session->tokens--;
+        return true;
+    }
+    
+    void resume_throttled_sessions() {
+        if (throttled_sessions.empty()) return;
+        std::vector<ClientSession*> resumed;
+        resumed.swap(throttled_sessions);
+        for (size_t i = 0; i < resumed.size(); i++) {
+            resumed[i]->throttled = false;
+            serve_session(resumed[i], 0);   // May throttle (or close) it again
+        }
+    }
+    
+    void recycle_session(ClientSession* session) {
+        std::vector<ClientSession*>& idle = idle_sessions[session->proto];
+        if (idle.size() < IDLE_SESSIONS) {
+            idle.push_back(session);
+        } else {
+            delete session;
+        }
+    }
+    
+    void init_session_pool() {
+        for (int proto = 0; proto < 3; proto++) {
+            open_sessions[proto] = 0;
+            idle_sessions[proto].reserve(IDLE_SESSIONS);
+#ifdef MEMORY_CONSTRAINED
+            while (idle_sessions[proto].size() < IDLE_SESSIONS) {
+                idle_sessions[proto].push_back(new ClientSession(this, -1, static_cast<Protocol>(proto)));
+            }
+#endif
+        }
+    }
+    
+    void service_client(ClientSession* session, uint32_t events) {
+        int64_t started = monotonic_ns();
+        int fd = session->fd;
+        serve_session(session, events);     // May close (and retire) the session
+        int64_t finished = monotonic_ns();
+        network_latency.record(started, finished);
+        comm_trace.record(TRACE_SESSION, static_cast<uint16_t>(fd), started, finished);
+    }
+    
+    void serve_session(ClientSession* session, uint32_t events) {
+        // Persistent sessions on both ports: control commands are framed by CRLF
+        // (a bare LF is accepted too), management requests are HTTP/1.1 with
+        // keep-alive. Either may be pipelined - replies go back in request order.
+        if (events & EPOLLERR) {
+            close_session(session);
+            return;
+        }
+        
+        if (session->streaming) {
+            // Push-only session - input is discarded, EOF ends the subscription
+            bool open = true;
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+                open = read_available(session);
+                session->rx.clear();
+            }
+            if (!open || !flush_session(session)) {
+                close_session(session);
+                return;
+            }
+            update_interest(session);
+            return;
+        }
+        
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !session->closing) {
+            if (!read_available(session)) {
+                session->closing = true; // Peer closed - answer what it sent, then close
+            }
+        }
+        
+        // Alternate answering and flushing until the pipelined input is used
+        // up or the socket stops taking output (EPOLLOUT resumes from there)
+        size_t pending;
+        do {
+            pending = session->rx.size();
+            if (session->proto == PROTO_CONTROL) {
+                process_control_lines(session);
+            } else if (session->proto == PROTO_MODBUS) {
+                process_modbus_frames(session);
+            } else {
+                process_http_requests(session);
+            }
+            if (!flush_session(session)) {
+                close_session(session);
+                return;
+            }
+        } while (session->tx.empty() && !session->rx.empty() && session->rx.size() != pending &&
+                 !session->streaming);
+        
+        if (session->closing && session->tx.empty() && !session->streaming && !session->throttled) {
+            close_session(session);
+            return;
+        }
+        update_interest(session);
+    }
+    
+    // Pull everything currently readable into the session receive buffer.
+    // Returns false once the peer has closed or the socket failed.
+    bool read_available(ClientSession* session) {
+        while (session->rx.free_space() > 0) {
+            size_t room = session->rx.free_space();
+            char* dst = session->rx.reserve(room);
+            ssize_t bytes = recv(session->fd, dst, room, MSG_DONTWAIT);
+            if (bytes > 0) {
+                session->rx.commit(bytes);
+                continue;
+            }
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+            if (bytes < 0 && errno == EINTR) continue;
+            return false;
+        }
+        return true;
+    }
+    
+    // Answer every complete command in the receive buffer; a client sending an
+    // over-long line gets an error and its session is closed. Commands are
+    // parsed in place and replies written straight into the session's output
+    // buffer - stops early (leaving commands queued) while that buffer is full.
+    void process_control_lines(ClientSession* session) {
+        while (session->tx.free_space() >= MAX_REPLY_LENGTH && !session->rx.empty()) {
+            const char* line = session->rx.data();
+            const char* eol = static_cast<const char*>(memchr(line, '\n', session->rx.size()));
+            if (eol == nullptr) break;
+            
+            size_t len = eol - line;
+            if (len > 0 && line[len - 1] == '\r') len--;
+            if (len > 0 && !admit_request(session)) break;
+            if (len > 0) {
+                char* out = session->tx.reserve(MAX_REPLY_LENGTH);
+                session->tx.commit(process_legacy_command(session, line, len, out, MAX_REPLY_LENGTH));
+            }
+            session->rx.consume(eol - line + 1);
+        }
+        
+        bool partial = !session->rx.empty() &&
+            memchr(session->rx.data(), '\n', session->rx.size()) == nullptr;
+        
+        // A final command without terminator from a client that has already
+        // half-closed still gets its answer (e.g. printf 'RR0' | nc). Rate
+        // limited like any other command - a throttled session keeps it in rx.
+        if (session->closing && partial && session->tx.free_space() >= MAX_REPLY_LENGTH) {
+            if (admit_request(session)) {
+                char* out = session->tx.reserve(MAX_REPLY_LENGTH);
+                session->tx.commit(process_legacy_command(session, session->rx.data(), session->rx.size(),
+                                                          out, MAX_REPLY_LENGTH));
+                session->rx.clear();
+            }
+        }
+        else if (partial && session->rx.size() > MAX_COMMAND_LENGTH) {
+            session->tx.append("ERR0\r\n", 6);
+            session->rx.clear();
+            session->closing = true;
+        }
+    }
+    
+    // Answer every complete Modbus/TCP frame in the receive buffer, in order,
+    // so a master may pipeline transactions. A frame that is not Modbus
+    // (protocol id, length) closes the session - the stream cannot be resynced.
+    void process_modbus_frames(ClientSession* session) {
+        while (session->tx.free_space() >= MODBUS_ADU_MAX && session->rx.size() >= 8) {
+            const uint8_t* adu = reinterpret_cast<const uint8_t*>(session->rx.data());
+            uint16_t protocol = get_be16(adu + 2);
+            uint16_t length = get_be16(adu + 4);    // Unit id onwards
+            if (protocol != 0 || length < 2 || length > MODBUS_ADU_MAX - 6) {
+                session->rx.clear();
+                session->closing = true;
+                return;
+            }
+            if (session->rx.size() < 6u + length || !admit_request(session)) break;
+            
+            int64_t started = monotonic_ns();
+            uint8_t* out = reinterpret_cast<uint8_t*>(session->tx.reserve(MODBUS_ADU_MAX));
+            session->tx.commit(process_modbus_request(adu, 6 + length, out));
+            request_latency[modbus_request(adu[7])].record(started, monotonic_ns());
+            session->rx.consume(6 + length);
+        }
+    }
+    
+    static RequestKind modbus_request(uint8_t function) {
+        switch (function) {
+            case 1:  return REQ_MODBUS_FC1;
+            case 2:  return REQ_MODBUS_FC2;
+            case 3:  return REQ_MODBUS_FC3;
+            case 4:  return REQ_MODBUS_FC4;
+            case 6:  return REQ_MODBUS_FC6;
+            case 16: return REQ_MODBUS_FC16;
+            default: return REQ_MODBUS_OTHER;
+        }
+    }
+    
+    static uint16_t get_be16(const uint8_t* p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+    
+    static void put_be16(uint8_t* p, uint16_t value) {
+        p[0] = static_cast<uint8_t>(value >> 8);
+        p[1] = static_cast<uint8_t>(value);
+    }
+    
+    // Modbus data model over the process image:
+    //   coils (FC1)             %Q0.. as 0/1, then %QX0..
+    //   discrete inputs (FC2)   %I0.. as 0/1, then %IX0..
+    //   input registers (FC4)   %I0.., then %Q0..
+    //   holding registers       %MW0.. - FC3 reads, FC6/FC16 writes, which
+    //                           take effect at the start of the next scan
+    // Reads come from the published scan, so one frame is one scan's data.
+    // A rejected request gets the standard exception (illegal function,
+    // address or value).
+    // Writes the response ADU into out and returns its length.
+    size_t process_modbus_request(const uint8_t* adu, size_t len, uint8_t* out) {
+        const SystemState& snap = published();
+        const uint8_t* pdu = adu + 7;
+        size_t pdu_len = len - 7;
+        uint8_t function = pdu[0];
+        uint8_t* reply = out + 7;
+        uint8_t exception = 0;
+        size_t reply_len = 0;
+        
+        switch (function) {
+            case 1: case 2: {
+                uint16_t start = pdu_len == 5 ? get_be16(pdu + 1) : 0;
+                uint16_t quantity = pdu_len == 5 ? get_be16(pdu + 3) : 0;
+                const uint16_t* words = function == 1 ? snap.outputs : snap.inputs;
+                const uint8_t* bits = function == 1 ? snap.discrete_outputs : snap.discrete_inputs;
+                uint32_t word_count = function == 1 ? MAX_OUTPUTS : MAX_INPUTS;
+                uint32_t bit_count = function == 1 ? MAX_DISCRETE_OUTPUTS : MAX_DISCRETE_INPUTS;
+                if (quantity < 1 || quantity > 2000) { exception = 3; break; }
+                if (static_cast<uint32_t>(start) + quantity > word_count + bit_count) { exception = 2; break; }
+                reply[0] = function;
+                reply[1] = static_cast<uint8_t>((quantity + 7) / 8);
+                memset(reply + 2, 0, reply[1]);
+                for (uint32_t i = 0; i < quantity; i++) {
+                    uint32_t point = start + i;
+                    bool on = point < word_count ? words[point] != 0 :
+                              (bits[(point - word_count) / 8] >> ((point - word_count) % 8)) & 1;
+                    if (on) reply[2 + i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+                }
+                reply_len = 2 + reply[1];
+                break;
+            }
+            case 3: case 4: {
+                uint16_t start = pdu_len == 5 ? get_be16(pdu + 1) : 0;
+                uint16_t quantity = pdu_len == 5 ? get_be16(pdu + 3) : 0;
+                uint32_t count = function == 3 ? MAX_REGISTERS : MAX_INPUTS + MAX_OUTPUTS;
+                if (quantity < 1 || quantity > 125) { exception = 3; break; }
+                if (static_cast<uint32_t>(start) + quantity > count) { exception = 2; break; }
+                reply[0] = function;
+                reply[1] = static_cast<uint8_t>(quantity * 2);
+                for (uint32_t i = 0; i < quantity; i++) {
+                    uint32_t point = start + i;
+                    uint16_t value = function == 3 ? snap.registers[point] :
+                                     point < static_cast<uint32_t>(MAX_INPUTS) ? snap.inputs[point] :
+                                     snap.outputs[point - MAX_INPUTS];
+                    put_be16(reply + 2 + i * 2, value);
+                }
+                reply_len = 2 + quantity * 2;
+                break;
+            }
+            case 6: {
+                if (pdu_len != 5) { exception = 3; break; }
+                uint16_t address = get_be16(pdu + 1);
+                uint16_t value = get_be16(pdu + 3);
+                if (address >= MAX_REGISTERS) { exception = 2; break; }
+                queue_register_writes(address, &value, 1);
+                memcpy(reply, pdu, 5);  // Echo of the request
+                reply_len = 5;
+                break;
+            }
+            case 16: {
+                uint16_t start = pdu_len >= 6 ? get_be16(pdu + 1) : 0;
+                uint16_t quantity = pdu_len >= 6 ? get_be16(pdu + 3) : 0;
+                if (quantity < 1 || quantity > 123 || pdu[5] != quantity * 2 || pdu_len != 6u + quantity * 2) {
+                    exception = 3;
+                    break;
+                }
+                if (static_cast<uint32_t>(start) + quantity > static_cast<uint32_t>(MAX_REGISTERS)) { exception = 2; break; }
+                uint16_t values[123];
+                for (uint32_t i = 0; i < quantity; i++) values[i] = get_be16(pdu + 6 + i * 2);
+                queue_register_writes(start, values, quantity);
+                memcpy(reply, pdu, 5);  // Function, start, quantity
+                reply_len = 5;
+                break;
+            }
+            default:
+                exception = 1;  // Illegal function
+                break;
+        }
+        if (exception != 0) {
+            reply[0] = static_cast<uint8_t>(function | 0x80);
+            reply[1] = exception;
+            reply_len = 2;
+        }
+        
+        memcpy(out, adu, 4);    // Transaction and protocol id
+        put_be16(out + 4, static_cast<uint16_t>(reply_len + 1));
+        out[6] = adu[6];        // Unit id
+        return 7 + reply_len;
+    }
+    
+    // Network side of a register write: stage it for the scan thread. The
+    // batch holds every register, so a burst never has to be refused.
+    void queue_register_writes(uint32_t address, const uint16_t* values, uint32_t count) {
+        std::lock_guard<std::mutex> lock(write_lock);
+        WriteBatch& batch = *pending_batch;
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t a = address + i;
+            if (!batch.dirty[a]) {
+                batch.dirty[a] = 1;
+                batch.addresses[batch.count++] = static_cast<uint16_t>(a);
+            }
+            batch.value[a] = values[i];
+        }
+        register_writes.fetch_add(count, std::memory_order_relaxed);
+    }
+    
+    // Send as much queued output as the socket accepts. Returns false on a hard error.
+    bool flush_session(ClientSession* session) {
+        while (!session->tx.empty()) {
+            ssize_t bytes = send(session->fd, session->tx.data(), session->tx.size(),
+                                 MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (bytes > 0) {
+                session->tx.consume(bytes);
+                bytes_sent.add(static_cast<uint32_t>(bytes));
+                continue;
+            }
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+        return true;
+    }
+    
+    // Read while there is room for replies and the rate limit allows, wait for
+    // writability while output is pending. A session that stops reading
+    // leaves the rest in the kernel - the client's TCP window closes.
+    void update_interest(ClientSession* session) {
+        uint32_t wanted = 0;
+        if (session->streaming ||
+            (!session->closing && !session->throttled && session->tx.free_space() >= response_reserve(session))) {
+            wanted |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (!session->tx.empty()) {
+            wanted |= EPOLLOUT;
+        }
+        if (wanted != session->events) {
+            session->events = wanted;
+            reactor.modify(session->fd, wanted, session);
+        }
+    }
+    
+    // Output space a session must have free before its next request is answered
+    static size_t response_reserve(const ClientSession* session) {
+        return session->proto == PROTO_CONTROL ? MAX_REPLY_LENGTH :
+               session->proto == PROTO_MODBUS ? MODBUS_ADU_MAX : MGMT_MAX_RESPONSE;
+    }
+    
+    // Answer every complete HTTP request in the receive buffer, in order
+    void process_http_requests(ClientSession* session) {
+        while (!session->closing && !session->streaming &&
+               session->tx.free_space() >= MGMT_MAX_RESPONSE && !session->rx.empty()) {
+            const char* data = session->rx.data();
+            size_t avail = session->rx.size();
+            const char* header_end = find_header_end(data, avail);
+            if (header_end == nullptr) {
+                if (avail == MGMT_RX_CAPACITY) {
+                    // Request head does not fit the receive buffer
+                    send_http_error(session->tx, 431, "Request Header Fields Too Large");
+                    session->closing = true;
+                }
+                return;
+            }
+            
+            HttpRequest request;
+            if (!parse_http_request(data, header_end - data, &request)) {
+                send_http_error(session->tx, 400, "Bad Request");
+                session->closing = true;
+                return;
+            }
+            
+            size_t total = (header_end - data) + request.content_length;
+            if (total > avail) {
+                if (total > MGMT_RX_CAPACITY) {
+                    send_http_error(session->tx, 413, "Payload Too Large");
+                    session->closing = true;
+                }
+                return; // Wait for the rest of the body
+            }
+            if (!admit_request(session)) return;
+            
+            request.body = header_end;
+            int64_t started = monotonic_ns();
+            session->streaming = process_http_request(request, session->tx);
+            request_latency[http_request(request)].record(started, monotonic_ns());
+            session->rx.consume(total);
+            if (session->streaming) {
+                session->rx.clear(); // The stream owns the connection from here on
+            } else if (!request.keep_alive) {
+                session->closing = true;
+            }
+        }
+        
+        // Peer half-closed with an incomplete request left over - nothing to answer
+        if (session->closing) {
+            session->rx.clear();
+        }
+    }
+    
+    void close_session(ClientSession* session) {
+        reactor.remove(session->fd);
+        close(session->fd);
+        sessions_closed[session->proto].add(1);
+        open_sessions[session->proto]--;
+        if (session->throttled) {
+            throttled_sessions.erase(std::find(throttled_sessions.begin(), throttled_sessions.end(), session));
+        }
+        if (comm_trace.enabled()) {
+            int64_t now = monotonic_ns();
+            comm_trace.record(TRACE_CLOSE, static_cast<uint16_t>(session->fd), now, now);
+        }
+        
+        for (size_t i = 0; i < sessions.size(); i++) {
+            if (sessions[i] == session) {
+                sessions[i] = sessions.back();
+                sessions.pop_back();
+                break;
+            }
+        }
+        reactor.retire(session);
+    }
+    
+    // Process simple ASCII protocol commands (typical of early 2000s).
+    // The command (without line terminator) is parsed in place and the reply,
+    // CRLF included, written into out. Returns the reply length. Never throws
+    // and, SUB aside, never allocates: malformed input simply yields an error code.
+    size_t process_legacy_command(ClientSession* session, const char* command, size_t len,
+                                  char* out, size_t cap) {
+        int64_t started = monotonic_ns();
+        const SystemState& snap = published();
+        FixedWriter response(out, cap);
+        const char* end = command + len;
+        RequestKind kind = REQ_INVALID;
+        
+        if (len > 2 && command[0] == 'R' && command[2] == 'B' && point_table(command[1]) != nullptr) {
+            // Block Read - format: RIB/ROB/RRB<start>,<count>
+            // Reply: <count> fixed-width values, comma separated, one scan's data
+            int size = 0;
+            const uint16_t* table = point_table(command[1], &size);
+            const char* p = command + 3;
+            kind = point_request(command[1], REQ_RIB);
+            uint32_t start = 0, count = 0;
+            if (!parse_uint(p, end, &start) || p == end || *p++ != ',' ||
+                !parse_uint(p, end, &count) || p != end) {
+                response.put("ERR0"); // Malformed arguments
+            } else if (count < 1 || start + count > static_cast<uint32_t>(size)) {
+                response.put("ERR1"); // Range outside the point table
+            } else {
+                for (uint32_t i = start; i < start + count; i++) {
+                    if (i > start) response.put(',');
+                    response.put_uint(table[i], 4);
+                }
+            }
+        }
+        else if (len >= 2 && command[0] == 'R' && command[1] == 'M') {
+            // Multi Read - format: RM<type><address>[,<type><address>...]
+            // e.g. RMI0,I3,O0,R100 - values returned in request order
+            kind = REQ_RM;
+            read_multiple(command + 2, end, response);
+        }
+        else if (len >= 2 && command[0] == 'R' && point_table(command[1]) != nullptr) {
+            // Read Input/Output/Register - format: RI/RO/RR<address>
+            int size = 0;
+            const uint16_t* table = point_table(command[1], &size);
+            const char* p = command + 2;
+            kind = point_request(command[1], REQ_RI);
+            int32_t addr = 0;
+            if (!parse_address(p, end, &addr)) {
+                response.put("ERR0"); // No address given
+            } else if (addr >= 0 && addr < size) {
+                response.put_uint(table[addr], 4);
+            } else {
+                response.put("ERR1"); // Invalid address
+            }
+        }
+        else if (len > 2 && command[0] == 'W' && command[1] == 'R') {
+            // Register Write - format: WR<address>,<value> or WRB<start>,<value>[,<value>...]
+            // Applied at the start of the next scan; reply OK
+            kind = command[2] == 'B' ? REQ_WRB : REQ_WR;
+            write_registers(command + 2, end, response);
+        }
+        else if (len > 3 && memcmp(command, "SUB", 3) == 0) {
+            // Subscribe - format: SUB<type><address>[:<deadband>][,...]
+            // e.g. SUBI0,R100:5 - replaces any earlier list; reply as RM, then
+            // EVT<cycle>,<type><address>=<value>[,...] lines as points move
+            kind = REQ_SUB;
+            subscribe_points(session, command + 3, end, response);
+        }
+        else if (len == 5 && memcmp(command, "UNSUB", 5) == 0) {
+            kind = REQ_UNSUB;
+            session->subscription.clear();
+            response.put("OK");
+        }
+        else if (len >= 6 && memcmp(command, "STATUS", 6) == 0) {
+            // Status request - return fixed-width status string
+            kind = REQ_STATUS;
+            char timestamp[32];
+            size_t timestamp_len = Timestamp::local(timestamp, sizeof(timestamp));
+            response.put(snap.running ? "RUN," : "STP,"); // Same width - fields stay fixed
+            response.put_uint(snap.cycle_count, 8);
+            response.put(',');
+            response.put_uint(snap.error_codes, 2, 16);
+            response.put(',');
+            response.put(timestamp, timestamp_len);
+        }
+        else {
+            response.put("ERR0"); // Unknown command
+        }
+        
+        response.put("\r\n"); // Legacy line ending
+        request_latency[kind].record(started, monotonic_ns());
+        return response.length();
+    }
+    
+    // RI/RO/RR (or the block forms) from the point type letter
+    static RequestKind point_request(char type, RequestKind input_kind) {
+        return static_cast<RequestKind>(input_kind + (type == 'I' ? 0 : type == 'O' ? 1 : 2));
+    }
+    
+    // Map a protocol point type letter onto its SystemState array
+    const uint16_t* point_table(char type, int* size = nullptr) const {
+        const SystemState& snap = published();
+        const uint16_t* table = nullptr;
+        int count = 0;
+        switch (type) {
+            case 'I': table = snap.inputs;    count = MAX_INPUTS;    break;
+            case 'O': table = snap.outputs;   count = MAX_OUTPUTS;   break;
+            case 'R': table = snap.registers; count = MAX_REGISTERS; break;
+            default: break;
+        }
+        if (size) *size = count;
+        return table;
+    }
+    
+    // Parse decimal digits at p (advancing it). Fails on no digits or overflow.
+    static bool parse_uint(const char*& p, const char* end, uint32_t* value) {
+        const char* first = p;
+        uint32_t v = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (v > 99999999) return false;
+            v = v * 10 + (*p++ - '0');
+        }
+        *value = v;
+        return p != first;
+    }
+    
+    // Single-read address, lenient the way the original std::stoi parse was:
+    // leading blanks and a sign are accepted, trailing characters ignored
+    static bool parse_address(const char*& p, const char* end, int32_t* addr) {
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+        uint32_t value = 0;
+        if (!parse_uint(p, end, &value)) return false;
+        *addr = negative ? -static_cast<int32_t>(value) : static_cast<int32_t>(value);
+        return true;
+    }
+    
+    void write_registers(const char* p, const char* end, FixedWriter& response) {
+        bool block = (p < end && *p == 'B');
+        if (block) p++;
+        uint16_t values[MAX_COMMAND_LENGTH / 2];
+        uint32_t start = 0, count = 0;
+        bool too_large = false;
+        bool valid = parse_uint(p, end, &start) && p < end && *p++ == ',';
+        while (valid) {
+            uint32_t value = 0;
+            if (count == sizeof(values) / sizeof(values[0]) || !parse_uint(p, end, &value)) {
+                valid = false;
+                break;
+            }
+            too_large |= value > 65535;
+            values[count++] = static_cast<uint16_t>(value);
+            if (p == end) break;
+            if (!block || *p++ != ',') valid = false;
+        }
+        
+        if (!valid) {
+            response.put("ERR0");   // Malformed arguments
+        } else if (start + count > static_cast<uint32_t>(MAX_REGISTERS)) {
+            response.put("ERR1");   // Outside the register table
+        } else if (too_large) {
+            response.put("ERR2");   // Value does not fit a register
+        } else {
+            queue_register_writes(start, values, count);
+            response.put("OK");
+        }
+    }
+    
+    void subscribe_points(ClientSession* session, const char* p, const char* end, FixedWriter& response) {
+        // Same all-or-nothing validation as RM - a bad list keeps the old one
+        ClientSession::SubscribedPoint points[MAX_COMMAND_LENGTH / 2];
+        size_t count = 0;
+        
+        while (true) {
+            int size = 0;
+            const uint16_t* table = (p < end) ? point_table(*p, &size) : nullptr;
+            uint32_t addr = 0, deadband = 0;
+            const char* q = p + 1;
+            if (table == nullptr || !parse_uint(q, end, &addr) ||
+                (q < end && *q == ':' && !parse_uint(++q, end, &deadband)) ||
+                count == sizeof(points) / sizeof(points[0])) {
+                response.put("ERR0"); // Malformed point reference
+                return;
+            }
+            if (addr >= static_cast<uint32_t>(size)) {
+                response.put("ERR1");
+                return;
+            }
+            if (deadband > 65535) {
+                response.put("ERR2");
+                return;
+            }
+            ClientSession::SubscribedPoint& point = points[count++];
+            point.type = *p;
+            point.address = static_cast<uint16_t>(addr);
+            point.point = static_cast<uint16_t>(addr + (*p == 'I' ? 0 : *p == 'O' ? MAX_INPUTS : MAX_INPUTS + MAX_OUTPUTS));
+            point.deadband = static_cast<uint16_t>(deadband);
+            point.reported = table[addr];
+            
+            if (q == end) break;
+            if (*q != ',') {
+                response.put("ERR0");
+                return;
+            }
+            p = q + 1;
+        }
+        
+        session->subscription.assign(points, points + count);
+        session->report_resync = false;
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) response.put(',');
+            response.put_uint(points[i].reported, 4);
+        }
+    }
+    
+    void read_multiple(const char* p, const char* end, FixedWriter& response) {
+        // Values are only emitted once the whole list has validated, so an
+        // error never leaves a half-written reply
+        uint16_t values[MAX_COMMAND_LENGTH / 2];
+        size_t count = 0;
+        
+        while (true) {
+            int size = 0;
+            const uint16_t* table = (p < end) ? point_table(*p, &size) : nullptr;
+            uint32_t addr = 0;
+            const char* q = p + 1;
+            if (table == nullptr || !parse_uint(q, end, &addr) ||
+                count == sizeof(values) / sizeof(values[0])) {
+                response.put("ERR0"); // Malformed point reference
+                return;
+            }
+            if (addr >= static_cast<uint32_t>(size)) {
+                response.put("ERR1");
+                return;
+            }
+            values[count++] = table[addr];
+            
+            if (q == end) break;
+            if (*q != ',') {
+                response.put("ERR0");
+                return;
+            }
+            p = q + 1;
+        }
+        
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) response.put(',');
+            response.put_uint(values[i], 4);
+        }
+    }
+    
+    // Parsed management request - every pointer refers into the receive buffer
+    struct HttpRequest {
+        const char* method;  size_t method_len;
+        const char* path;    size_t path_len;
+        const char* query;   size_t query_len;
+        const char* etag;    size_t etag_len;    // If-None-Match
+        size_t content_length;
+        const char* body;                        // content_length bytes, once complete
+        bool keep_alive;
+        bool head_only;
+        
+        HttpRequest() : method(nullptr), method_len(0), path(nullptr), path_len(0),
+                        query(nullptr), query_len(0), etag(nullptr), etag_len(0),
+                        content_length(0), body(nullptr), keep_alive(true), head_only(false) {}
+        
+        bool path_is(const char* route) const {
+            return strlen(route) == path_len && memcmp(path, route, path_len) == 0;
+        }
+    };
+    
+    // End of the request head (just past the blank line), or nullptr if incomplete
+    static const char* find_header_end(const char* data, size_t len) {
+        for (size_t i = 3; i < len; i++) {
+            if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+                return data + i + 1;
+            }
+        }
+        return nullptr;
+    }
+    
+    static bool header_name_is(const char* line, size_t len, const char* name) {
+        size_t n = strlen(name);
+        return len > n && line[n] == ':' && strncasecmp(line, name, n) == 0;
+    }
+    
+    static bool contains_token(const char* value, size_t len, const char* token) {
+        size_t n = strlen(token);
+        for (size_t i = 0; i + n <= len; i++) {
+            if (strncasecmp(value + i, token, n) == 0) return true;
+        }
+        return false;
+    }
+    
+    static bool parse_http_request(const char* data, size_t len, HttpRequest* request) {
+        const char* end = data + len;
+        const char* line_end = static_cast<const char*>(memchr(data, '\r', len));
+        
+        // Request line: METHOD SP target SP HTTP/1.x
+        const char* sp1 = static_cast<const char*>(memchr(data, ' ', line_end - data));
+        if (sp1 == nullptr) return false;
+        const char* sp2 = static_cast<const char*>(memchr(sp1 + 1, ' ', line_end - sp1 - 1));
+        if (sp2 == nullptr || line_end - sp2 < 9 || memcmp(sp2 + 1, "HTTP/1.", 7) != 0) return false;
+        
+        request->method = data;
+        request->method_len = sp1 - data;
+        request->path = sp1 + 1;
+        const char* question = static_cast<const char*>(memchr(sp1 + 1, '?', sp2 - sp1 - 1));
+        if (question != nullptr) {
+            request->path_len = question - request->path;
+            request->query = question + 1;
+            request->query_len = sp2 - question - 1;
+        } else {
+            request->path_len = sp2 - request->path;
+        }
+        request->keep_alive = (sp2[8] != '0'); // HTTP/1.0 defaults to close
+        request->head_only = (request->method_len == 4 && memcmp(data, "HEAD", 4) == 0);
+        
+        // Header fields the management interface cares about
+        const char* line = line_end + 2;
+        while (line < end) {
+            const char* eol = static_cast<const char*>(memchr(line, '\r', end - line));
+            if (eol == nullptr || eol == line) break;
+            size_t line_len = eol - line;
+            const char* colon = static_cast<const char*>(memchr(line, ':', line_len));
+            if (colon != nullptr) {
+                const char* value = colon + 1;
+                while (value < eol && (*value == ' ' || *value == '\t')) value++;
+                size_t value_len = eol - value;
+                
+                if (header_name_is(line, line_len, "Connection")) {
+                    if (contains_token(value, value_len, "close")) request->keep_alive = false;
+                    if (contains_token(value, value_len, "keep-alive")) request->keep_alive = true;
+                } else if (header_name_is(line, line_len, "If-None-Match")) {
+                    request->etag = value;
+                    request->etag_len = value_len;
+                } else if (header_name_is(line, line_len, "Content-Length")) {
+                    uint32_t length = 0;
+                    const char* p = value;
+                    if (!parse_uint(p, eol, &length)) return false;
+                    request->content_length = length;
+                }
+            }
+            line = eol + 2;
+        }
+        return true;
+    }
+    
+    // Raw value of a query parameter, up to the next '&'
+    static bool query_string(const HttpRequest& request, const char* name,
+                             const char** value, size_t* length) {
+        size_t n = strlen(name);
+        const char* p = request.query;
+        const char* end = request.query + request.query_len;
+        while (p != nullptr && p < end) {
+            if (static_cast<size_t>(end - p) > n && memcmp(p, name, n) == 0 && p[n] == '=') {
+                *value = p + n + 1;
+                const char* amp = static_cast<const char*>(memchr(*value, '&', end - *value));
+                *length = (amp != nullptr ? amp : end) - *value;
+                return true;
+            }
+            p = static_cast<const char*>(memchr(p, '&', end - p));
+            if (p != nullptr) p++;
+        }
+        return false;
+    }
+    
+    // Value of a numeric query parameter (e.g. start in ?start=0&count=16)
+    static bool query_param(const HttpRequest& request, const char* name, uint32_t* value) {
+        const char* digits;
+        size_t length;
+        return query_string(request, name, &digits, &length) &&
+               parse_uint(digits, digits + length, value);
+    }
+    
+    // ETags follow the scan counter - a poller that has already seen this
+    // cycle's data gets a bodiless 304 instead of the document
+    static bool etag_matches(const HttpRequest& request, uint32_t version) {
+        if (request.etag == nullptr) return false;
+        char tag[16];
+        FixedWriter writer(tag, sizeof(tag));
+        writer.put('"');
+        writer.put_uint(version);
+        writer.put('"');
+        return contains_token(request.etag, request.etag_len, "*") ||
+               (request.etag_len >= writer.length() &&
+                memmem(request.etag, request.etag_len, tag, writer.length()) != nullptr);
+    }
+    
+    void write_http_head(SessionBuffer& out, int status, const char* reason,
+                         const char* content_type, size_t content_length,
+                         bool keep_alive, bool with_etag, uint32_t version) {
+        char* dst = out.reserve(512);
+        if (dst == nullptr) return;
+        FixedWriter response(dst, 512);
+        
+        response.put_literal("HTTP/1.1 ");
+        response.put_uint(status);
+        response.put(' ');
+        response.put(reason);
+        response.put_literal("\r\n");
+        if (content_type != nullptr) {
+            response.put_literal("Content-Type: ");
+            response.put(content_type);
+            response.put_literal("\r\n");
+        }
+        response.put_literal("Access-Control-Allow-Origin: *\r\n");
+        response.put_literal("Cache-Control: no-cache\r\n");
+        if (with_etag) {
+            response.put_literal("ETag: \"");
+            response.put_uint(version);
+            response.put_literal("\"\r\n");
+        }
+        response.put_literal("Content-Length: ");
+        response.put_uint(content_length);
+        response.put_literal("\r\n");
+        if (keep_alive) {
+            response.put_literal("Connection: keep-alive\r\n");
+        } else {
+            response.put_literal("Connection: close\r\n");
+        }
+        response.put_literal("\r\n");
+        out.commit(response.length());
+    }
+    
+    void send_http_error(SessionBuffer& out, int status, const char* reason) {
+        write_http_head(out, status, reason, nullptr, 0, false, false, 0);
+    }
+    
+    // Versioned response: 304 when the client already has this version
+    void send_http_versioned(SessionBuffer& out, const HttpRequest& request, const char* content_type,
+                             const char* body, size_t length, uint32_t version) {
+        if (etag_matches(request, version)) {
+            write_http_head(out, 304, "Not Modified", nullptr, 0, request.keep_alive, true, version);
+            return;
+        }
+        write_http_head(out, 200, "OK", content_type, length, request.keep_alive, true, version);
+        if (!request.head_only) {
+            out.append(body, length);
+        }
+    }
+    
+    static RequestKind http_request(const HttpRequest& request) {
+        if (request.head_only) return REQ_HTTP_HEAD;
+        if (request.method_len == 3 && memcmp(request.method, "GET", 3) == 0) return REQ_HTTP_GET;
+        if (request.method_len == 4 && memcmp(request.method, "POST", 4) == 0) return REQ_HTTP_POST;
+        return REQ_HTTP_OTHER;
+    }
+    
+    // Management request routing. The status document was already serialized
+    // for the current scan, so the common poll costs a header and a copy.
+    // Returns true when the response opened an /events push stream.
+    bool process_http_request(const HttpRequest& request, SessionBuffer& out) {
+        bool is_get = request.head_only ||
+            (request.method_len == 3 && memcmp(request.method, "GET", 3) == 0);
+        if (request.method_len == 4 && memcmp(request.method, "POST", 4) == 0 && request.path_is("/registers")) {
+            post_registers(request, out);
+            return false;
+        }
+        if (!is_get) {
+            write_http_head(out, 405, "Method Not Allowed", nullptr, 0, request.keep_alive, false, 0);
+            return false;
+        }
+        
+        if (request.path_is("/") || request.path_is("/status")) {
+            send_http_versioned(out, request, "application/json",
+                                status_doc.json, status_doc.length, status_doc.version);
+        }
+        else if (request.path_is("/registers") || request.path_is("/inputs") ||
+                 request.path_is("/outputs")) {
+            const SystemState& snap = published();
+            char type = request.path[1] == 'r' ? 'R' : (request.path[1] == 'i' ? 'I' : 'O');
+            int size = 0;
+            const uint16_t* table = point_table(type, &size);
+            uint32_t start = 0, count = size;
+            query_param(request, "start", &start);
+            query_param(request, "count", &count);
+            if (start >= static_cast<uint32_t>(size) || count < 1 ||
+                count > static_cast<uint32_t>(size) - start) {
+                write_http_head(out, 400, "Bad Request", nullptr, 0, request.keep_alive, false, 0);
+                return false;
+            }
+            
+            FixedWriter body(http_body, sizeof(http_body));
+            body.put_literal("{\"cycle\": ");
+            body.put_uint(snap.cycle_count);
+            body.put_literal(", \"start\": ");
+            body.put_uint(start);
+            body.put_literal(", \"count\": ");
+            body.put_uint(count);
+            body.put_literal(", \"values\": [");
+            for (uint32_t i = start; i < start + count; i++) {
+                if (i > start) body.put_literal(", ");
+                body.put_uint(table[i]);
+            }
+            body.put_literal("]}\n");
+            send_http_versioned(out, request, "application/json",
+                                http_body, body.length(), snap.cycle_count);
+        }
+        else if (request.path_is("/discrete")) {
+            send_discrete(request, out);
+        }
+        else if (request.path_is("/history")) {
+            send_history(request, out);
+        }
+        else if (request.path_is("/scan")) {
+            FixedWriter body(http_body, sizeof(http_body));
+            render_scan_report(body);
+            body.put('\n');
+            send_http_versioned(out, request, "application/json",
+                                http_body, body.length(), published().cycle_count);
+        }
+        else if (request.path_is("/events")) {
+            return start_event_stream(request, out);
+        }
+        else if (request.path_is("/trace")) {
+            send_trace(request, out);
+        }
+        else if (request.path_is("/metrics")) {
+            FixedWriter body(http_body, sizeof(http_body));
+            render_metrics(body);
+            write_http_head(out, 200, "OK", "text/plain; version=0.0.4", body.length(),
+                            request.keep_alive, false, 0);
+            if (!request.head_only) out.append(http_body, body.length());
+        }
+        else {
+            write_http_head(out, 404, "Not Found", nullptr, 0, request.keep_alive, false, 0);
+        }
+        return false;
+    }
+    
+    // Switch the session to a text/event-stream: headers without a length, then
+    // a full snapshot; every later scan appends a delta event
+    bool start_event_stream(const HttpRequest& request, SessionBuffer& out) {
+        if (request.head_only) {
+            write_http_head(out, 200, "OK", "text/event-stream", 0, request.keep_alive, false, 0);
+            return false;
+        }
+        
+        FixedWriter head(http_body, sizeof(http_body));
+        head.put_literal("HTTP/1.1 200 OK\r\n"
+                         "Content-Type: text/event-stream\r\n"
+                         "Access-Control-Allow-Origin: *\r\n"
+                         "Cache-Control: no-cache\r\n"
+                         "X-Accel-Buffering: no\r\n"
+                         "Connection: keep-alive\r\n"
+                         "\r\n"
+                         "retry: 1000\n\n");
+        out.append(http_body, head.length());
+        
+        FixedWriter event(sse_event, sizeof(sse_event));
+        render_snapshot_event(event);
+        out.append(sse_event, event.length());
+        return true;
+    }
+    
+    static void put_point_array(FixedWriter& event, const char* name, const uint16_t* values, int count) {
+        event.put('"');
+        event.put(name);
+        event.put_literal("\":[");
+        for (int i = 0; i < count; i++) {
+            if (i > 0) event.put(',');
+            event.put_uint(values[i]);
+        }
+        event.put(']');
+    }
+    
+    // Changed points as {"index":value,...}; returns false if nothing changed
+    static bool put_point_changes(FixedWriter& event, const char* name, const uint16_t* values,
+                                  const uint16_t* previous, int count) {
+        bool any = false;
+        for (int i = 0; i < count; i++) {
+            if (values[i] == previous[i]) continue;
+            if (!any) {
+                event.put_literal(",\"");
+                event.put(name);
+                event.put_literal("\":{");
+            } else {
+                event.put(',');
+            }
+            event.put('"');
+            event.put_uint(i);
+            event.put_literal("\":");
+            event.put_uint(values[i]);
+            any = true;
+        }
+        if (any) event.put('}');
+        return any;
+    }
+    
+    void render_snapshot_event(FixedWriter& event) {
+        const SystemState& snap = published();
+        event.put_literal("id: ");
+        event.put_uint(snap.cycle_count);
+        event.put_literal("\nevent: snapshot\ndata: {\"cycle\":");
+        event.put_uint(snap.cycle_count);
+        event.put_literal(",\"error_codes\":");
+        event.put_uint(snap.error_codes);
+        event.put(',');
+        put_point_array(event, "inputs", snap.inputs, MAX_INPUTS);
+        event.put(',');
+        put_point_array(event, "outputs", snap.outputs, MAX_OUTPUTS);
+        event.put(',');
+        put_point_array(event, "registers", snap.registers, MAX_REGISTERS);
+        event.put_literal("}\n\n");
+    }
+    
+    // Render this scan's delta once and append it to every subscriber
+    void publish_scan_events() {
+        const SystemState& snap = published();
+        bool have_subscribers = false;
+        for (size_t i = 0; i < sessions.size(); i++) {
+            if (sessions[i]->streaming) have_subscribers = true;
+        }
+        
+        size_t length = 0;
+        if (have_subscribers) {
+            FixedWriter event(sse_event, sizeof(sse_event));
+            event.put_literal("id: ");
+            event.put_uint(snap.cycle_count);
+            event.put_literal("\nevent: delta\ndata: {\"cycle\":");
+            event.put_uint(snap.cycle_count);
+            bool changed = false;
+            if (snap.error_codes != streamed_state.error_codes) {
+                event.put_literal(",\"error_codes\":");
+                event.put_uint(snap.error_codes);
+                changed = true;
+            }
+            changed |= put_point_changes(event, "inputs", snap.inputs, streamed_state.inputs, MAX_INPUTS);
+            changed |= put_point_changes(event, "outputs", snap.outputs, streamed_state.outputs, MAX_OUTPUTS);
+            changed |= put_point_changes(event, "registers", snap.registers, streamed_state.registers,
+                                         MAX_REGISTERS);
+            event.put_literal("}\n\n");
+            
+            if (changed) {
+                length = event.length();
+                last_event_cycle = snap.cycle_count;
+            } else if (snap.cycle_count - last_event_cycle >= SSE_KEEPALIVE_CYCLES) {
+                FixedWriter keepalive(sse_event, sizeof(sse_event));
+                keepalive.put_literal(": keepalive\n\n");
+                length = keepalive.length();
+                last_event_cycle = snap.cycle_count;
+            }
+        }
+        publish_point_events(snap);
+        memcpy(streamed_state.inputs, snap.inputs, sizeof(snap.inputs));
+        memcpy(streamed_state.outputs, snap.outputs, sizeof(snap.outputs));
+        memcpy(streamed_state.registers, snap.registers, sizeof(snap.registers));
+        streamed_state.error_codes = snap.error_codes;
+        
+        if (length == 0) return;
+        
+        // Walk backwards - close_session() moves the last session into the hole
+        for (size_t i = sessions.size(); i-- > 0;) {
+            ClientSession* session = sessions[i];
+            if (!session->streaming) continue;
+            
+            if (session->resync && session->tx.free_space() >= MGMT_MAX_RESPONSE) {
+                // Caught up again after falling behind - deltas no longer apply
+                char* dst = session->tx.reserve(MGMT_MAX_RESPONSE);
+                FixedWriter snapshot(dst, MGMT_MAX_RESPONSE);
+                render_snapshot_event(snapshot);
+                session->tx.commit(snapshot.length());
+                session->resync = false;
+            } else if (!session->resync && session->tx.free_space() >= length) {
+                session->tx.append(sse_event, length);
+            } else {
+                session->resync = true; // Slow subscriber - skip, never block the scan
+            }
+            
+            if (!flush_session(session)) {
+                close_session(session);
+                continue;
+            }
+            update_interest(session);
+        }
+    }
+    
+    void mark_changed_points(const uint16_t* values, const uint16_t* previous, int count, uint32_t first) {
+        for (int i = 0; i < count; i++) {
+            if (values[i] != previous[i]) {
+                uint32_t point = first + i;
+                changed_points[point / 32] |= 1u << (point % 32);
+            }
+        }
+    }
+    
+    // Report-by-exception for SUB clients. The scan's diff against the
+    // previous image is taken once; each subscriber then only inspects its
+    // own points that changed, against the value it was last sent. A session
+    // without room for its EVT line is skipped and fully rechecked next scan.
+    void publish_point_events(const SystemState& snap) {
+        bool have_subscribers = false;
+        for (size_t i = 0; i < sessions.size(); i++) {
+            if (!sessions[i]->subscription.empty()) have_subscribers = true;
+        }
+        if (!have_subscribers) return;
+        
+        memset(changed_points, 0, sizeof(changed_points));
+        mark_changed_points(snap.inputs, streamed_state.inputs, MAX_INPUTS, 0);
+        mark_changed_points(snap.outputs, streamed_state.outputs, MAX_OUTPUTS, MAX_INPUTS);
+        mark_changed_points(snap.registers, streamed_state.registers, MAX_REGISTERS, MAX_INPUTS + MAX_OUTPUTS);
+        
+        // Walk backwards - close_session() moves the last session into the hole
+        for (size_t i = sessions.size(); i-- > 0;) {
+            ClientSession* session = sessions[i];
+            std::vector<ClientSession::SubscribedPoint>& points = session->subscription;
+            if (points.empty()) continue;
+            
+            size_t worst = POINT_EVENT_HEAD + points.size() * POINT_EVENT_ENTRY;
+            char* dst = session->tx.reserve(worst);
+            if (dst == nullptr) {
+                session->report_resync = true; // Slow client - never block the scan
+                continue;
+            }
+            FixedWriter line(dst, worst);
+            line.put_literal("EVT");
+            line.put_uint(snap.cycle_count);
+            bool any = false;
+            for (size_t j = 0; j < points.size(); j++) {
+                ClientSession::SubscribedPoint& point = points[j];
+                if (!session->report_resync &&
+                    !(changed_points[point.point / 32] & (1u << (point.point % 32)))) continue;
+                uint16_t value = point_table(point.type)[point.address];
+                uint16_t moved = value > point.reported ? value - point.reported : point.reported - value;
+                if (moved <= point.deadband) continue;
+                line.put(',');
+                line.put(point.type);
+                line.put_uint(point.address);
+                line.put('=');
+                line.put_uint(value, 4);
+                point.reported = value;
+                any = true;
+            }
+            session->report_resync = false;
+            if (!any) continue;
+            line.put("\r\n");
+            session->tx.commit(line.length());
+            
+            if (!flush_session(session)) {
+                close_session(session);
+                continue;
+            }
+            update_interest(session);
+        }
+    }
+    
+    static const char* task_name(TaskClass task) { return task == TASK_FAST ? "FAST" : "MAST"; }
+    
+    int task_period_ms(TaskClass task) const {
+        return task == TASK_FAST ? config.fast_period_ms : config.scan_period_ms;
+    }
+    
+    // Largest power-of-two ring that fits the configured budget
+    void init_history() {
+        if (config.history_mb <= 0) return;
+        uint64_t budget = static_cast<uint64_t>(config.history_mb) * 1024 * 1024 /
+                          static_cast<uint64_t>(config.history_instances > 0 ? config.history_instances : 1);
+        uint32_t capacity = 1;
+        while (static_cast<uint64_t>(capacity) * 2 * HISTORY_SAMPLE_BYTES <= budget) capacity *= 2;
+        if (static_cast<uint64_t>(capacity) * HISTORY_SAMPLE_BYTES > budget) return;
+        
+        history_values.assign(static_cast<size_t>(capacity) * LOG_CHANNELS, 0);
+        history_cycles.assign(capacity, 0);
+        history_times.assign(capacity, 0);
+        large_body.resize(MGMT_TX_CAPACITY - 512);
+        history_capacity = capacity;
+        console.info("History: %u scans (%llus at %dms)", capacity,
+                     static_cast<unsigned long long>(capacity) * config.scan_period_ms / 1000, config.scan_period_ms);
+    }
+    
+    void init_trace() {
+        if (config.trace_events <= 0) return;
+        uint32_t capacity = 1;
+        while (capacity < static_cast<uint32_t>(config.trace_events)) capacity *= 2;
+        scan_trace.resize(capacity);
+        comm_trace.resize(capacity);
+        large_body.resize(MGMT_TX_CAPACITY - 512);
+        console.info("Tracing: newest %u scan and network events (GET /trace, SIGUSR1)", capacity);
+    }
+    
+    // Logging thread: store one scan, overwriting the oldest
+    void append_history(const LogRecord& record) {
+        if (history_capacity == 0) return;
+        uint32_t seq = history_head.load(std::memory_order_relaxed);
+        size_t slot = seq & (history_capacity - 1);
+        uint16_t* column = &history_values[slot];
+        
+        history_cycles[slot] = record.cycle;
+        history_times[slot] = record.time_us;
+        column[0] = record.error_codes;
+        column += history_capacity;
+        for (int i = 0; i < MAX_INPUTS; i++, column += history_capacity) *column = record.inputs[i];
+        for (int i = 0; i < MAX_OUTPUTS; i++, column += history_capacity) *column = record.outputs[i];
+        for (int i = 0; i < MAX_REGISTERS; i++, column += history_capacity) *column = record.registers[i];
+        history_head.store(seq + 1, std::memory_order_release);
+    }
+    
+    // First sample in [lo, hi) whose cycle is >= cycle (cycles only grow)
+    uint32_t history_seek_cycle(uint32_t lo, uint32_t hi, uint32_t cycle) const {
+        while (lo != hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (history_cycles[mid & (history_capacity - 1)] < cycle) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    
+    uint32_t history_seek_time(uint32_t lo, uint32_t hi, int64_t time_us) const {
+        while (lo != hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (history_times[mid & (history_capacity - 1)] < time_us) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+    
+    // POST /registers?start=N with the values as the body, "[100, 50]" or
+    // "100,50". 202 Accepted: they are applied at the start of the next scan.
+    void post_registers(const HttpRequest& request, SessionBuffer& out) {
+        uint16_t values[MGMT_RX_CAPACITY / 2];
+        uint32_t start = 0, count = 0;
+        const char* p = request.body;
+        const char* end = p + request.content_length;
+        bool valid = query_param(request, "start", &start);
+        
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '[')) p++;
+        while (valid && p < end && *p != ']') {
+            uint32_t value = 0;
+            if (count == sizeof(values) / sizeof(values[0]) || !parse_uint(p, end, &value) || value > 65535) {
+                valid = false;
+                break;
+            }
+            values[count++] = static_cast<uint16_t>(value);
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+            if (p < end && *p == ',') {
+                p++;
+                while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+            } else if (p < end && *p != ']') {
+                valid = false;
+            }
+        }
+        if (!valid || count == 0 || start + count > static_cast<uint32_t>(MAX_REGISTERS)) {
+            write_http_head(out, 400, "Bad Request", nullptr, 0, request.keep_alive, false, 0);
+            return;
+        }
+        queue_register_writes(start, values, count);
+        
+        FixedWriter body(http_body, sizeof(http_body));
+        body.put_literal("{\"start\": ");
+        body.put_uint(start);
+        body.put_literal(", \"count\": ");
+        body.put_uint(count);
+        body.put_literal(", \"after_cycle\": ");
+        body.put_uint(published().cycle_count);
+        body.put_literal("}\n");
+        write_http_head(out, 202, "Accepted", "application/json", body.length(), request.keep_alive, false, 0);
+        out.append(http_body, body.length());
+    }
+    
+    // GET /discrete - both packed banks as hex, byte 0 first, so point n is
+    // bit n % 8 of byte n / 8
+    void send_discrete(const HttpRequest& request, SessionBuffer& out) {
+        const SystemState& snap = published();
+        FixedWriter body(http_body, sizeof(http_body));
+        body.put_literal("{\"cycle\": ");
+        body.put_uint(snap.cycle_count);
+        body.put_literal(", \"inputs\": {\"count\": ");
+        body.put_uint(MAX_DISCRETE_INPUTS);
+        body.put_literal(", \"bits\": \"");
+        for (size_t i = 0; i < sizeof(snap.discrete_inputs); i++) body.put_uint(snap.discrete_inputs[i], 2, 16);
+        body.put_literal("\"}, \"outputs\": {\"count\": ");
+        body.put_uint(MAX_DISCRETE_OUTPUTS);
+        body.put_literal(", \"bits\": \"");
+        for (size_t i = 0; i < sizeof(snap.discrete_outputs); i++) body.put_uint(snap.discrete_outputs[i], 2, 16);
+        body.put_literal("\"}}\n");
+        send_http_versioned(out, request, "application/json", http_body, body.length(), snap.cycle_count);
+    }
+    
+    // GET /history?channels=I0,MW100[&from=CYCLE][&to=CYCLE][&seconds=N][&buckets=N]
+    // Min/max/avg per bucket, so one request draws a trend of any length
+    void send_history(const HttpRequest& request, SessionBuffer& out) {
+        int channels[HISTORY_MAX_CHANNELS];
+        int channel_count = 0;
+        const char* list;
+        size_t list_len;
+        bool valid = history_capacity > 0 && query_string(request, "channels", &list, &list_len);
+        const char* p = list;
+        const char* end = valid ? list + list_len : list;
+        while (valid && p < end) {
+            if (channel_count == HISTORY_MAX_CHANNELS || !parse_log_channel(p, end, &channels[channel_count++])) {
+                valid = false;
+            } else if (p < end && *p++ != ',') {
+                valid = false;
+            }
+        }
+        
+        uint32_t from = 0, to = UINT32_MAX, seconds = 0, buckets = 100;
+        query_param(request, "from", &from);
+        query_param(request, "to", &to);
+        query_param(request, "seconds", &seconds);
+        query_param(request, "buckets", &buckets);
+        if (!valid || channel_count == 0 || buckets < 1 || buckets > HISTORY_MAX_BUCKETS || from > to) {
+            write_http_head(out, history_capacity > 0 ? 400 : 404,
+                            history_capacity > 0 ? "Bad Request" : "Not Found",
+                            nullptr, 0, request.keep_alive, false, 0);
+            return;
+        }
+        
+        // Worst-case size per bucket, from the room left in the session
+        size_t room = std::min(large_body.size(), out.free_space() > 512 ? out.free_space() - 512 : 0);
+        size_t fixed = 256 + 48 * channel_count;
+        size_t per_bucket = 24 + 22 * channel_count;
+        if (room > fixed) {
+            buckets = std::min<uint32_t>(buckets, static_cast<uint32_t>((room - fixed) / per_bucket));
+        } else {
+            buckets = 0;
+        }
+        if (buckets == 0) {
+            write_http_head(out, 503, "Service Unavailable", nullptr, 0, request.keep_alive, false, 0);
+            return;
+        }
+        
+        // The logging thread keeps writing while this runs: leave it slack at
+        // the old end, then check nothing read was overwritten and retry if so
+        for (int attempt = 0; attempt < 3; attempt++) {
+            uint32_t head = history_head.load(std::memory_order_acquire);
+            uint32_t slack = history_capacity / 16;
+            uint32_t lo = head > history_capacity - slack ? head - (history_capacity - slack) : 0;
+            uint32_t hi = head;
+            if (from > 0) lo = history_seek_cycle(lo, hi, from);
+            if (to != UINT32_MAX) hi = history_seek_cycle(lo, hi, to + 1);
+            if (seconds > 0 && hi > lo) {
+                int64_t newest = history_times[(hi - 1) & (history_capacity - 1)];
+                lo = history_seek_time(lo, hi, newest - static_cast<int64_t>(seconds) * 1000000LL);
+            }
+            
+            FixedWriter body(&large_body[0], large_body.size());
+            render_history(body, lo, hi, channels, channel_count, buckets);
+            
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint32_t now = history_head.load(std::memory_order_relaxed);
+            if (lo == hi || now - lo < history_capacity) {
+                write_http_head(out, 200, "OK", "application/json", body.length(),
+                                request.keep_alive, false, 0);
+                if (!request.head_only) out.append(&large_body[0], body.length());
+                return;
+            }
+        }
+        write_http_head(out, 503, "Service Unavailable", nullptr, 0, request.keep_alive, false, 0);
+    }
+    
+    void render_history(FixedWriter& out, uint32_t lo, uint32_t hi,
+                        const int* channels, int channel_count, uint32_t buckets) {
+        const uint32_t mask = history_capacity - 1;
+        const uint32_t samples = hi - lo;
+        if (buckets > samples) buckets = samples;
+        
+        out.put_literal("{\"capacity\": ");
+        out.put_uint(history_capacity);
+        out.put_literal(", \"samples\": ");
+        out.put_uint(samples);
+        out.put_literal(", \"buckets\": ");
+        out.put_uint(buckets);
+        if (samples == 0) {
+            out.put_literal(", \"series\": {}}\n");
+            return;
+        }
+        
+        const int64_t start_us = history_times[lo & mask];
+        out.put_literal(", \"cycle_first\": ");
+        out.put_uint(history_cycles[lo & mask]);
+        out.put_literal(", \"cycle_last\": ");
+        out.put_uint(history_cycles[(hi - 1) & mask]);
+        char start[32];
+        size_t start_len = Timestamp::iso8601(start_us, start, sizeof(start));
+        out.put_literal(", \"start\": \"");
+        out.put(start, start_len);
+        out.put_literal("\", \"start_ms\": ");
+        out.put_uint64(static_cast<uint64_t>(start_us / 1000));
+        
+        // Bucket b covers samples [lo + b*samples/buckets, lo + (b+1)*samples/buckets)
+        out.put_literal(",\n \"t_ms\": [");
+        for (uint32_t b = 0; b < buckets; b++) {
+            uint32_t first = lo + static_cast<uint32_t>(static_cast<uint64_t>(b) * samples / buckets);
+            if (b > 0) out.put(',');
+            out.put_uint(static_cast<uint32_t>((history_times[first & mask] - start_us) / 1000));
+        }
+        out.put_literal("],\n \"cycle\": [");
+        for (uint32_t b = 0; b < buckets; b++) {
+            uint32_t first = lo + static_cast<uint32_t>(static_cast<uint64_t>(b) * samples / buckets);
+            if (b > 0) out.put(',');
+            out.put_uint(history_cycles[first & mask]);
+        }
+        out.put_literal("],\n \"series\": {");
+        
+        for (int c = 0; c < channel_count; c++) {
+            const uint16_t* column = &history_values[static_cast<size_t>(channels[c]) * history_capacity];
+            uint16_t minimum[HISTORY_MAX_BUCKETS], maximum[HISTORY_MAX_BUCKETS];
+            uint32_t tenths[HISTORY_MAX_BUCKETS];   // avg * 10, rounded
+            for (uint32_t b = 0; b < buckets; b++) {
+                uint32_t first = lo + static_cast<uint32_t>(static_cast<uint64_t>(b) * samples / buckets);
+                uint32_t last = lo + static_cast<uint32_t>(static_cast<uint64_t>(b + 1) * samples / buckets);
+                uint16_t mn = 0xFFFF, mx = 0;
+                uint64_t sum = 0;
+                for (uint32_t seq = first; seq != last; seq++) {
+                    uint16_t v = column[seq & mask];
+                    if (v < mn) mn = v;
+                    if (v > mx) mx = v;
+                    sum += v;
+                }
+                uint64_t count = last - first;
+                minimum[b] = mn;
+                maximum[b] = mx;
+                tenths[b] = static_cast<uint32_t>((sum * 20 + count) / (count * 2));
+            }
+            
+            if (c > 0) out.put(',');
+            out.put_literal("\n  \"");
+            put_log_channel_name(out, channels[c]);
+            out.put_literal("\": {\"min\": [");
+            for (uint32_t b = 0; b < buckets; b++) {
+                if (b > 0) out.put(',');
+                out.put_uint(minimum[b]);
+            }
+            out.put_literal("], \"max\": [");
+            for (uint32_t b = 0; b < buckets; b++) {
+                if (b > 0) out.put(',');
+                out.put_uint(maximum[b]);
+            }
+            out.put_literal("], \"avg\": [");
+            for (uint32_t b = 0; b < buckets; b++) {
+                if (b > 0) out.put(',');
+                out.put_uint(tenths[b] / 10);
+                if (tenths[b] % 10 != 0) {
+                    out.put('.');
+                    out.put_uint(tenths[b] % 10);
+                }
+            }
+            out.put_literal("]}");
+        }
+        out.put_literal("}}\n");
+    }
+    
+    // The /scan document - scheduler settings and every enabled task in full
+    void render_scan_report(FixedWriter& out) {
+        out.put_literal("{\"rt_priority\": ");
+        out.put_uint(config.rt_priority);
+        out.put_literal(", \"cpu\": ");
+        if (config.cpu >= 0) out.put_uint(config.cpu); else out.put_literal("null");
+        out.put_literal(", \"tasks\": [");
+        render_task_timing(out, TASK_MAST, true);
+        if (fast_task_enabled()) {
+            out.put_literal(", ");
+            render_task_timing(out, TASK_FAST, true);
+        }
+        const SystemState& snap = published();
+        out.put_literal("], \"program\": {\"name\": \"");
+        out.put_json_escaped(program_name.c_str());
+        out.put_literal("\", \"rungs\": ");
+        out.put_uint(rung_labels.size());
+        out.put_literal(", \"instructions\": ");
+        out.put_uint(program_instructions());
+        out.put_literal(", \"bytes\": ");
+        out.put_uint(program_bytes());
+        out.put_literal(", \"rung_budget_us\": ");
+        out.put_uint(config.rung_budget_us);
+        out.put_literal(", \"rung_overruns\": ");
+        out.put_uint(snap.rung_overruns);
+        out.put_literal(", \"worst_rung\": ");
+        if (config.rung_budget_us > 0 && snap.worst_rung < rung_labels.size()) {
+            out.put('"');
+            out.put_json_escaped(rung_labels[snap.worst_rung].c_str());
+            out.put('"');
+        } else {
+            out.put_literal("null");
+        }
+        out.put_literal(", \"worst_rung_us\": ");
+        out.put_uint(snap.worst_rung_us);
+        out.put_literal("}}");
+    }
+    
+    // One task's scheduler statistics as a JSON object; histograms only for /scan
+    void render_task_timing(FixedWriter& out, TaskClass task, bool histograms) {
+        const ScanStats& stats = published().stats[task];
+        out.put_literal("{\"task\": \"");
+        out.put(task_name(task));
+        out.put_literal("\", \"period_ms\": ");
+        out.put_uint(task_period_ms(task));
+        out.put_literal(", \"scans\": ");
+        out.put_uint64(stats.scans);
+        out.put_literal(", \"overruns\": ");
+        out.put_uint64(stats.overruns);
+        out.put_literal(", \"missed_deadlines\": ");
+        out.put_uint64(stats.missed_deadlines);
+        out.put_literal(", \"duration_us\": ");
+        put_min_max_mean(out, stats.duration_min_us, stats.duration_max_us, stats.duration_sum_us, stats.scans);
+        out.put_literal(", \"jitter_us\": ");
+        put_min_max_mean(out, stats.jitter_min_us, stats.jitter_max_us, stats.jitter_sum_us, stats.scans);
+        if (histograms) {
+            out.put_literal(", \"duration_histogram\": ");
+            put_histogram(out, stats.duration_histogram);
+            out.put_literal(", \"jitter_histogram\": ");
+            put_histogram(out, stats.jitter_histogram);
+        }
+        out.put('}');
+    }
+    
+    static void put_min_max_mean(FixedWriter& out, uint32_t min, uint32_t max, uint64_t sum, uint64_t count) {
+        out.put_literal("{\"min\": ");
+        out.put_uint(count ? min : 0);
+        out.put_literal(", \"max\": ");
+        out.put_uint(max);
+        out.put_literal(", \"mean\": ");
+        out.put_uint64(count ? sum / count : 0);
+        out.put('}');
+    }
+    
+    // Buckets as [{"le_us": limit, "count": n}, ...], the last bucket open-ended
+    static void put_histogram(FixedWriter& out, const uint64_t* buckets) {
+        out.put('[');
+        for (int i = 0; i < ScanStats::BUCKETS; i++) {
+            if (i > 0) out.put_literal(", ");
+            out.put_literal("{\"le_us\": ");
+            if (i < ScanStats::BUCKETS - 1) out.put_uint(ScanStats::bucket_limit_us(i));
+            else out.put_literal("null");
+            out.put_literal(", \"count\": ");
+            out.put_uint64(buckets[i]);
+            out.put('}');
+        }
+        out.put(']');
+    }
+    
+    // Prometheus text exposition of the basic runtime counters
+    void render_metrics(FixedWriter& body) {
+        const SystemState& snap = published();
+        body.put_literal("# HELP plc_scan_cycles_total Completed scan cycles.\n"
+                         "# TYPE plc_scan_cycles_total counter\n"
+                         "plc_scan_cycles_total ");
+        body.put_uint(snap.cycle_count);
+        body.put_literal("\n# HELP plc_running Scan executor running (1) or stopped (0).\n"
+                         "# TYPE plc_running gauge\n"
+                         "plc_running ");
+        body.put_uint(running.load(std::memory_order_relaxed) ? 1 : 0);
+        body.put_literal("\n# HELP plc_task_period_ms Configured task period.\n"
+                         "# TYPE plc_task_period_ms gauge\n");
+        put_task_metric(body, "plc_task_period_ms", TASK_MAST, config.scan_period_ms);
+        if (fast_task_enabled()) put_task_metric(body, "plc_task_period_ms", TASK_FAST, config.fast_period_ms);
+        body.put_literal("# HELP plc_scan_overruns_total Scans that ran past the next deadline.\n"
+                         "# TYPE plc_scan_overruns_total counter\n");
+        put_task_metric(body, "plc_scan_overruns_total", TASK_MAST, snap.stats[TASK_MAST].overruns);
+        if (fast_task_enabled()) put_task_metric(body, "plc_scan_overruns_total", TASK_FAST, snap.stats[TASK_FAST].overruns);
+        body.put_literal("# HELP plc_scan_duration_max_us Longest scan so far.\n"
+                         "# TYPE plc_scan_duration_max_us gauge\n");
+        put_task_metric(body, "plc_scan_duration_max_us", TASK_MAST, snap.stats[TASK_MAST].duration_max_us);
+        if (fast_task_enabled()) put_task_metric(body, "plc_scan_duration_max_us", TASK_FAST, snap.stats[TASK_FAST].duration_max_us);
+        body.put_literal("# HELP plc_scan_jitter_max_us Largest wake-up lateness so far.\n"
+                         "# TYPE plc_scan_jitter_max_us gauge\n");
+        put_task_metric(body, "plc_scan_jitter_max_us", TASK_MAST, snap.stats[TASK_MAST].jitter_max_us);
+        if (fast_task_enabled()) put_task_metric(body, "plc_scan_jitter_max_us", TASK_FAST, snap.stats[TASK_FAST].jitter_max_us);
+        body.put_literal("# HELP plc_rung_overruns_total Rungs that exceeded the rung budget.\n"
+                         "# TYPE plc_rung_overruns_total counter\n"
+                         "plc_rung_overruns_total ");
+        body.put_uint(snap.rung_overruns);
+        body.put_literal("\n# HELP plc_log_records_total Scans written to the data log.\n"
+                         "# TYPE plc_log_records_total counter\n"
+                         "plc_log_records_total ");
+        body.put_uint(log_records_written.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_log_records_dropped_total Scans lost because the log writer fell behind.\n"
+                         "# TYPE plc_log_records_dropped_total counter\n"
+                         "plc_log_records_dropped_total ");
+        body.put_uint(log_records_dropped.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_log_batches_total Batched writes to the data log.\n"
+                         "# TYPE plc_log_batches_total counter\n"
+                         "plc_log_batches_total ");
+        body.put_uint(log_batches_written.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_log_bytes_total Bytes appended to the data log.\n"
+                         "# TYPE plc_log_bytes_total counter\n"
+                         "plc_log_bytes_total ");
+        body.put_uint(log_bytes_written.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_log_segment Sequence number of the segment being written.\n"
+                         "# TYPE plc_log_segment gauge\n"
+                         "plc_log_segment ");
+        body.put_uint(log_segment_current.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_register_writes_total Register writes accepted from the network.\n"
+                         "# TYPE plc_register_writes_total counter\n"
+                         "plc_register_writes_total ");
+        body.put_uint(register_writes.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_register_write_commits_total Scans that applied queued register writes.\n"
+                         "# TYPE plc_register_write_commits_total counter\n"
+                         "plc_register_write_commits_total ");
+        body.put_uint(register_write_commits.load(std::memory_order_relaxed));
+        body.put_literal("\n# HELP plc_error_codes Current error code bits.\n"
+                         "# TYPE plc_error_codes gauge\n"
+                         "plc_error_codes ");
+        body.put_uint(snap.error_codes);
+        body.put_literal("\n# HELP plc_sessions Open client sessions (both ports).\n"
+                         "# TYPE plc_sessions gauge\n"
+                         "plc_sessions ");
+        body.put_uint(sessions.size());
+        body.put_literal("\n# HELP plc_sessions_accepted_total Client sessions accepted.\n"
+                         "# TYPE plc_sessions_accepted_total counter\n");
+        put_protocol_metric(body, "plc_sessions_accepted_total", sessions_accepted);
+        body.put_literal("# HELP plc_sessions_closed_total Client sessions closed.\n"
+                         "# TYPE plc_sessions_closed_total counter\n");
+        put_protocol_metric(body, "plc_sessions_closed_total", sessions_closed);
+        body.put_literal("# HELP plc_sessions_refused_total Connections closed at the client limit.\n"
+                         "# TYPE plc_sessions_refused_total counter\n");
+        put_protocol_metric(body, "plc_sessions_refused_total", sessions_refused);
+        body.put_literal("# HELP plc_requests_throttled_total Times a session waited for its request rate limit.\n"
+                         "# TYPE plc_requests_throttled_total counter\n");
+        put_protocol_metric(body, "plc_requests_throttled_total", requests_throttled);
+        body.put_literal("# HELP plc_sent_bytes_total Bytes sent to clients.\n"
+                         "# TYPE plc_sent_bytes_total counter\n"
+                         "plc_sent_bytes_total ");
+        body.put_uint(bytes_sent.value());
+        
+        // Without a FAST task its phases run inside MAST; they are still
+        // timed separately, so both tasks are always reported
+        static const char* const PHASE_LABELS[TASK_COUNT][PHASE_COUNT] = {
+            { "phase=\"scan_inputs\",task=\"MAST\"", "phase=\"execute_control_logic\",task=\"MAST\"",
+              "phase=\"update_outputs\",task=\"MAST\"" },
+            { "phase=\"scan_inputs\",task=\"FAST\"", "phase=\"execute_control_logic\",task=\"FAST\"",
+              "phase=\"update_outputs\",task=\"FAST\"" },
+        };
+        body.put_literal("\n# HELP plc_phase_duration_us Time spent in each scan phase.\n"
+                         "# TYPE plc_phase_duration_us histogram\n");
+        for (int task = 0; task < TASK_COUNT; task++) {
+            for (int phase = 0; phase < PHASE_COUNT; phase++) {
+                phase_latency[task][phase].render(body, "plc_phase_duration_us", PHASE_LABELS[task][phase]);
+            }
+        }
+        publish_latency.render(body, "plc_phase_duration_us", "phase=\"log_cycle_data\",task=\"MAST\"");
+        network_latency.render(body, "plc_phase_duration_us",
+                               "phase=\"handle_network_communication\",task=\"comm\"");
+        
+        // Only opcodes that have been seen, to keep the page small
+        static const char* const REQUEST_LABELS[REQ_COUNT] = {
+            "protocol=\"control\",opcode=\"RI\"", "protocol=\"control\",opcode=\"RO\"",
+            "protocol=\"control\",opcode=\"RR\"", "protocol=\"control\",opcode=\"RIB\"",
+            "protocol=\"control\",opcode=\"ROB\"", "protocol=\"control\",opcode=\"RRB\"",
+            "protocol=\"control\",opcode=\"RM\"", "protocol=\"control\",opcode=\"WR\"",
+            "protocol=\"control\",opcode=\"WRB\"", "protocol=\"control\",opcode=\"SUB\"",
+            "protocol=\"control\",opcode=\"UNSUB\"", "protocol=\"control\",opcode=\"STATUS\"",
+            "protocol=\"control\",opcode=\"invalid\"",
+            "protocol=\"modbus\",opcode=\"1\"", "protocol=\"modbus\",opcode=\"2\"",
+            "protocol=\"modbus\",opcode=\"3\"", "protocol=\"modbus\",opcode=\"4\"",
+            "protocol=\"modbus\",opcode=\"6\"", "protocol=\"modbus\",opcode=\"16\"",
+            "protocol=\"modbus\",opcode=\"other\"",
+            "protocol=\"management\",opcode=\"GET\"", "protocol=\"management\",opcode=\"HEAD\"",
+            "protocol=\"management\",opcode=\"POST\"", "protocol=\"management\",opcode=\"other\"",
+        };
+        body.put_literal("# HELP plc_request_duration_us Time to answer a request, by opcode.\n"
+                         "# TYPE plc_request_duration_us histogram\n");
+        for (int kind = 0; kind < REQ_COUNT; kind++) {
+            if (request_latency[kind].count() == 0) continue;
+            request_latency[kind].render(body, "plc_request_duration_us", REQUEST_LABELS[kind]);
+        }
+        body.put_literal("# HELP plc_log_write_duration_us Time to commit one batch to the data log.\n"
+                         "# TYPE plc_log_write_duration_us histogram\n");
+        log_write_latency.render(body, "plc_log_write_duration_us", "task=\"log\"");
+    }
+    
+    // GET /trace[?events=N] - the newest events of both rings that fit one
+    // response, as Chrome trace JSON (chrome://tracing, ui.perfetto.dev)
+    void send_trace(const HttpRequest& request, SessionBuffer& out) {
+        if (!scan_trace.enabled()) {
+            write_http_head(out, 404, "Not Found", nullptr, 0, request.keep_alive, false, 0);
+            return;
+        }
+        size_t room = std::min(large_body.size(), out.free_space() > 512 ? out.free_space() - 512 : 0);
+        uint32_t limit = room > 1024 ? static_cast<uint32_t>((room - 1024) / TRACE_EVENT_JSON_MAX) : 0;
+        uint32_t requested = 0;
+        if (query_param(request, "events", &requested) && requested < limit) limit = requested;
+        
+        FixedWriter body(&large_body[0], large_body.size());
+        render_trace(body, limit);
+        write_http_head(out, 200, "OK", "application/json", body.length(), request.keep_alive, false, 0);
+        if (!request.head_only) out.append(&large_body[0], body.length());
+    }
+    
+    // SIGUSR1: the whole of both rings to <log-dir>/trace-<cycle>.json
+    void dump_trace() {
+        if (!scan_trace.enabled()) {
+            console.warning("SIGUSR1: tracing is off (--trace-events)");
+            return;
+        }
+        uint32_t limit = scan_trace.capacity() + comm_trace.capacity();
+        std::vector<char> text(static_cast<size_t>(limit) * TRACE_EVENT_JSON_MAX + 1024);
+        FixedWriter body(&text[0], text.size());
+        render_trace(body, limit);
+        
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/trace-%u.json", log_dir.c_str(), published().cycle_count);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        size_t done = 0;
+        while (fd >= 0 && done < body.length()) {
+            ssize_t n = write(fd, &text[done], body.length() - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            done += n;
+        }
+        if (fd < 0 || done < body.length()) {
+            console.error("Cannot write trace %s: %s", path, strerror(errno));
+        } else {
+            console.notice("? Trace written: %s", path);
+        }
+        if (fd >= 0) close(fd);
+    }
+    
+    // Up to max_events, split between the scan and communications rings
+    void render_trace(FixedWriter& out, uint32_t max_events) {
+        static const char* const NAMES[TRACE_NAME_COUNT] = {
+            "scan", "scan_inputs", "execute_control_logic", "update_outputs", "log_cycle_data",
+            "overrun", "handle_network_communication", "session", "accept", "close"
+        };
+        uint32_t comm_max = max_events / 2;
+        uint32_t scan_max = max_events - comm_max;
+        trace_copy.resize(scan_max > comm_max ? scan_max : comm_max);
+        
+        out.put_literal("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        out.put_literal("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": ");
+        out.put_uint(config.port_offset);
+        out.put_literal(", \"tid\": 1, \"args\": {\"name\": \"scan\"}},\n"
+                        "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": ");
+        out.put_uint(config.port_offset);
+        out.put_literal(", \"tid\": 2, \"args\": {\"name\": \"communications\"}}");
+        
+        for (int ring = 0; ring < 2; ring++) {
+            const TraceRing& trace = ring == 0 ? scan_trace : comm_trace;
+            uint32_t count = trace_copy.empty() ? 0 :
+                trace.snapshot(&trace_copy[0], ring == 0 ? scan_max : comm_max);
+            for (uint32_t i = 0; i < count; i++) {
+                const TraceRing::Event& event = trace_copy[i];
+                out.put_literal(",\n{\"name\": \"");
+                out.put(NAMES[event.name]);
+                out.put_literal("\", \"ph\": \"");
+                out.put(event.duration_ns == 0 && event.name != TRACE_SESSION ? 'i' : 'X');
+                out.put_literal("\", \"ts\": ");
+                out.put_uint64(static_cast<uint64_t>(event.start_ns) / 1000);
+                out.put('.');
+                out.put_uint(static_cast<uint32_t>(event.start_ns % 1000), 3);
+                if (event.duration_ns != 0 || event.name == TRACE_SESSION) {
+                    out.put_literal(", \"dur\": ");
+                    out.put_uint(event.duration_ns / 1000);
+                    out.put('.');
+                    out.put_uint(event.duration_ns % 1000, 3);
+                } else {
+                    out.put_literal(", \"s\": \"t\"");
+                }
+                out.put_literal(", \"pid\": ");
+                out.put_uint(config.port_offset);
+                out.put_literal(", \"tid\": ");
+                out.put(ring == 0 ? '1' : '2');
+                if (ring == 0) {
+                    out.put_literal(", \"args\": {\"task\": \"");
+                    out.put(task_name(static_cast<TaskClass>(event.arg)));
+                    out.put_literal("\"}}");
+                } else if (event.name != TRACE_PUBLISHED) {
+                    out.put_literal(", \"args\": {\"fd\": ");
+                    out.put_uint(event.arg);
+                    out.put_literal("}}");
+                } else {
+                    out.put('}');
+                }
+            }
+        }
+        out.put_literal("\n]}\n");
+    }
+    
+    // name{protocol="control"} value, for each protocol
+    static void put_protocol_metric(FixedWriter& body, const char* name, const MetricCounter* counters) {
+        static const char* const PROTOCOL_NAMES[3] = { "control", "management", "modbus" };
+        for (int proto = 0; proto < 3; proto++) {
+            body.put(name);
+            body.put_literal("{protocol=\"");
+            body.put(PROTOCOL_NAMES[proto]);
+            body.put_literal("\"} ");
+            body.put_uint(counters[proto].value());
+            body.put('\n');
+        }
+    }
+    
+    // name{task="MAST"} value
+    static void put_task_metric(FixedWriter& body, const char* name, TaskClass task, uint64_t value) {
+        body.put(name);
+        body.put_literal("{task=\"");
+        body.put(task_name(task));
+        body.put_literal("\"} ");
+        body.put_uint64(value);
+        body.put('\n');
+    }
+    
+    void render_status_document() {
+        const SystemState& snap = published();
+        char timestamp[32];
+        Timestamp::local(timestamp, sizeof(timestamp));
+        
+        // JSON status response for management network
+        FixedWriter doc(status_doc.json, sizeof(status_doc.json));
+        doc.put_literal(STATUS_JSON_DEVICE_INFO);
+        doc.put_uint(snap.cycle_count);
+        doc.put_literal("\n  },\n"
+                        "  \"operational_status\": {\n"
+                        "    \"status\": \"");
+        if (snap.running) doc.put_literal("RUNNING"); else doc.put_literal("STOPPED");
+        doc.put_literal("\",\n    \"scan_rate_ms\": ");
+        doc.put_uint(config.scan_period_ms);
+        doc.put_literal(",\n    \"error_codes\": \"0x");
+        doc.put_uint(snap.error_codes, 0, 16);
+        doc.put_literal("\",\n    \"last_error\": \"");
+        doc.put_json_escaped(snap.last_error);
+        doc.put_literal("\",\n    \"scan_timing\": ");
+        render_task_timing(doc, TASK_MAST, false);
+        if (fast_task_enabled()) {
+            doc.put_literal(",\n    \"fast_task_timing\": ");
+            render_task_timing(doc, TASK_FAST, false);
+        }
+        doc.put_literal("\n  },\n"
+                        "  \"process_data\": {\n"
+                        "    \"inputs\": {\n"
+                        "      \"temperature_raw\": ");
+        doc.put_uint(snap.inputs[0]);
+        doc.put_literal(",\n      \"cycle_input\": ");
+        doc.put_uint(snap.inputs[1]);
+        doc.put_literal(",\n      \"run_enable\": ");
+        doc.put_uint(snap.inputs[2]);
+        doc.put_literal(",\n      \"pressure_raw\": ");
+        doc.put_uint(snap.inputs[3]);
+        doc.put_literal("\n    },\n"
+                        "    \"outputs\": {\n"
+                        "      \"heater_command\": ");
+        doc.put_uint(snap.outputs[0]);
+        doc.put_literal(",\n      \"high_temp_alarm\": ");
+        doc.put_uint(snap.outputs[1]);
+        doc.put_literal(",\n      \"heartbeat_led\": ");
+        doc.put_uint(snap.outputs[15]);
+        doc.put_literal("\n    },\n"
+                        "    \"registers\": {\n"
+                        "      \"temperature_setpoint\": ");
+        doc.put_uint(snap.registers[0]);
+        doc.put_literal(",\n      \"alarm_threshold\": ");
+        doc.put_uint(snap.registers[1]);
+        doc.put_literal(",\n      \"current_temperature\": ");
+        doc.put_uint(snap.registers[100]);
+        doc.put_literal(",\n      \"heater_status\": ");
+        doc.put_uint(snap.registers[101]);
+        doc.put_literal("\n    }\n"
+                        "  },\n");
+        doc.put_literal(STATUS_JSON_NETWORK_INTERFACES);
+        render_memory_usage(doc);
+        doc.put_literal(",\n  \"timestamp\": \"");
+        doc.put(timestamp);
+        doc.put_literal("\"\n}\n");
+        
+        status_doc.length = doc.length();
+        status_doc.version = snap.cycle_count;
+    }
+    
+    // Program memory against the controller's limit, then the process as the
+    // kernel and allocator see it (shared by every instance of a host)
+    void render_memory_usage(FixedWriter& doc) {
+        const MemoryUsage::Sample& memory = MemoryUsage::current();
+        doc.put_uint(static_cast<uint32_t>((program_bytes() + 1023) / 1024));
+        doc.put_literal("KB/");
+        doc.put_uint(static_cast<uint32_t>(PROGRAM_MEMORY / 1024));
+        doc.put_literal("KB\",\n    \"memory_limit\": \"");
+        if (memory.limit_kb == 0) {
+            doc.put_literal("Unlimited");
+        } else {
+            doc.put_uint(memory.limit_kb / 1024);
+            doc.put_literal("MB (cgroup)");
+        }
+        doc.put_literal("\",\n    \"rss_kb\": ");
+        doc.put_uint(memory.rss_kb);
+        doc.put_literal(",\n    \"rss_peak_kb\": ");
+        doc.put_uint(memory.rss_peak_kb);
+        doc.put_literal(",\n    \"heap_kb\": ");
+        doc.put_uint(memory.heap_kb);
+        doc.put_literal(",\n    \"heap_peak_kb\": ");
+        doc.put_uint(memory.heap_peak_kb);
+        doc.put_literal("\n  }");
+    }
+    
+    // Scan thread: copy the process image into the log ring - never blocks,
+    // a full ring drops the sample and counts it
+    void queue_log_record() {
+        LogRecord* record = log_ring.acquire();
+        if (record == nullptr) {
+            log_records_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        record->cycle = state.cycle_count;
+        record->error_codes = state.error_codes;
+        memset(record->reserved, 0, sizeof(record->reserved));
+        record->time_us = Timestamp::now_us();
+        memcpy(record->inputs, state.inputs, sizeof(record->inputs));
+        memcpy(record->outputs, state.outputs, sizeof(record->outputs));
+        memcpy(record->registers, state.registers, sizeof(record->registers));
+        log_ring.publish();
+    }
+    
+    static const char* log_file_extension(PLCConfig::LogFormat format) {
+        switch (format) {
+            case PLCConfig::LOG_DELTA: return ".dlog";
+            case PLCConfig::LOG_CSV:   return ".log";
+            default:                   return ".bin";
+        }
+    }
+    
+    static void fill_log_header(LogFileHeader& header, const char* magic, int scan_period_ms) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, magic, sizeof(header.magic));
+        header.record_size = sizeof(LogRecord);
+        header.inputs = MAX_INPUTS;
+        header.outputs = MAX_OUTPUTS;
+        header.registers = MAX_REGISTERS;
+        header.scan_period_ms = static_cast<uint32_t>(scan_period_ms);
+    }
+    
+    // Same format and point layout - the scan period may differ between runs
+    static bool log_header_compatible(const LogFileHeader& a, const LogFileHeader& b) {
+        return memcmp(a.magic, b.magic, sizeof(a.magic)) == 0 && a.record_size == b.record_size &&
+               a.inputs == b.inputs && a.outputs == b.outputs && a.registers == b.registers;
+    }
+    
+    // Channel n of a record: error_codes, then inputs, outputs, registers
+    static uint16_t log_channel_value(const LogRecord& record, int channel) {
+        if (channel == 0) return record.error_codes;
+        channel -= 1;
+        if (channel < MAX_INPUTS) return record.inputs[channel];
+        channel -= MAX_INPUTS;
+        if (channel < MAX_OUTPUTS) return record.outputs[channel];
+        return record.registers[channel - MAX_OUTPUTS];
+    }
+    
+    static void set_log_channel(LogRecord& record, int channel, uint16_t value) {
+        if (channel == 0) { record.error_codes = static_cast<uint8_t>(value); return; }
+        channel -= 1;
+        if (channel < MAX_INPUTS) { record.inputs[channel] = value; return; }
+        channel -= MAX_INPUTS;
+        if (channel < MAX_OUTPUTS) { record.outputs[channel] = value; return; }
+        record.registers[channel - MAX_OUTPUTS] = value;
+    }
+    
+    // Deadband spec "I0=2,Q1=0,MW100=5,EC=0". Every listed channel is an
+    // analog channel (XOR coded); a change is only logged once it exceeds
+    // the channel's deadband. Unlisted channels log every change.
+    bool parse_log_deadbands(const char* spec, DeltaLogHeader& header) {
+        memset(header.deadband, 0, sizeof(header.deadband));
+        memset(header.analog, 0, sizeof(header.analog));
+        const char* p = spec;
+        const char* end = spec + strlen(spec);
+        while (p < end) {
+            int channel;
+            uint32_t deadband;
+            if (!parse_log_channel(p, end, &channel)) return false;
+            if (p == end || *p++ != '=' || !parse_uint(p, end, &deadband)) return false;
+            if (deadband > 65535) return false;
+            header.deadband[channel] = static_cast<uint16_t>(deadband);
+            header.analog[channel] = 1;
+            
+            if (p < end && *p++ != ',') return false;
+        }
+        return true;
+    }
+    
+    // Channel name EC, I<n>, Q<n> or MW<n> to its log channel number
+    static bool parse_log_channel(const char*& p, const char* end, int* channel) {
+        int base, limit;
+        if (end - p >= 2 && strncasecmp(p, "EC", 2) == 0) { base = 0; limit = 1; p += 2; }
+        else if (end - p >= 2 && strncasecmp(p, "MW", 2) == 0) { base = 1 + MAX_INPUTS + MAX_OUTPUTS; limit = MAX_REGISTERS; p += 2; }
+        else if (p < end && (*p == 'I' || *p == 'i')) { base = 1; limit = MAX_INPUTS; p++; }
+        else if (p < end && (*p == 'Q' || *p == 'q')) { base = 1 + MAX_INPUTS; limit = MAX_OUTPUTS; p++; }
+        else return false;
+        
+        uint32_t index = 0;
+        if (base != 0 && !parse_uint(p, end, &index)) return false;
+        if (index >= static_cast<uint32_t>(limit)) return false;
+        *channel = base + static_cast<int>(index);
+        return true;
+    }
+    
+    static void put_log_channel_name(FixedWriter& out, int channel) {
+        if (channel == 0) {
+            out.put_literal("EC");
+            return;
+        }
+        channel -= 1;
+        if (channel < MAX_INPUTS) {
+            out.put('I');
+        } else if (channel < MAX_INPUTS + MAX_OUTPUTS) {
+            out.put('Q');
+            channel -= MAX_INPUTS;
+        } else {
+            out.put_literal("MW");
+            channel -= MAX_INPUTS + MAX_OUTPUTS;
+        }
+        out.put_uint(channel);
+    }
+    
+    void init_delta_header() {
+        static const char DEFAULT_DEADBANDS[] = "I0=0,I3=0,MW100=0";  // Full resolution
+        memset(&delta_header, 0, sizeof(delta_header));
+        fill_log_header(delta_header.base, "PLCLOGD", config.scan_period_ms);
+        delta_header.keyframe_cycles = LOG_KEYFRAME_CYCLES;
+        const char* spec = config.log_deadbands != nullptr ? config.log_deadbands : DEFAULT_DEADBANDS;
+        if (!parse_log_deadbands(spec, delta_header)) {
+            console.warning("Invalid log deadbands \"%s\" - using %s", spec, DEFAULT_DEADBANDS);
+            parse_log_deadbands(DEFAULT_DEADBANDS, delta_header);
+        }
+        memset(&delta_encoder, 0, sizeof(delta_encoder));
+    }
+    
+    static void put_varint(uint8_t*& p, uint64_t value) {
+        while (value >= 0x80) {
+            *p++ = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        *p++ = static_cast<uint8_t>(value);
+    }
+    
+    static bool get_varint(const uint8_t*& p, const uint8_t* end, uint64_t* value) {
+        uint64_t result = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t byte = *p++;
+            result |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                *value = result;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    static uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    static int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+    
+    // MSB-first bit packing for the XOR-coded channels of one record
+    struct BitWriter {
+        uint8_t* p;
+        int used;               // Bits already in *p
+        explicit BitWriter(uint8_t* out) : p(out), used(0) {}
+        void put(uint32_t bits, int count) {
+            while (count-- > 0) {
+                if (used == 0) *p = 0;
+                *p |= static_cast<uint8_t>(((bits >> count) & 1) << (7 - used));
+                if (++used == 8) { p++; used = 0; }
+            }
+        }
+        uint8_t* finish() { return used ? p + 1 : p; }
+    };
+    
+    struct BitReader {
+        const uint8_t* p;
+        const uint8_t* end;
+        int used;
+        BitReader(const uint8_t* in, const uint8_t* limit) : p(in), end(limit), used(0) {}
+        bool get(int count, uint32_t* bits) {
+            uint32_t v = 0;
+            while (count-- > 0) {
+                if (p >= end) return false;
+                v = (v << 1) | ((*p >> (7 - used)) & 1);
+                if (++used == 8) { p++; used = 0; }
+            }
+            *bits = v;
+            return true;
+        }
+    };
+    
+    static int leading_zeros16(uint16_t v) { int n = 0; while (n < 16 && !(v & (0x8000 >> n))) n++; return n; }
+    static int trailing_zeros16(uint16_t v) { int n = 0; while (n < 16 && !(v & (1 << n))) n++; return n; }
+    
+    // Gorilla-style XOR coding of one analog sample against the last stored
+    // value: '0' + the meaningful bits when they fit the channel's current
+    // window, else '1' + 4-bit leading-zero count + 4-bit length + bits
+    static void put_xor(BitWriter& out, DeltaState& ref, int channel, uint16_t value) {
+        uint16_t x = value ^ ref.value[channel];
+        int lead = leading_zeros16(x);
+        int trail = trailing_zeros16(x);
+        int bits = ref.xor_bits[channel];
+        if (bits != 0 && lead >= ref.xor_lead[channel] && trail >= 16 - ref.xor_lead[channel] - bits) {
+            out.put(0, 1);
+            out.put(x >> (16 - ref.xor_lead[channel] - bits), bits);
+            return;
+        }
+        if (lead > 15) lead = 15;
+        bits = 16 - lead - trail;
+        out.put(1, 1);
+        out.put(lead, 4);
+        out.put(bits - 1, 4);
+        out.put(x >> trail, bits);
+        ref.xor_lead[channel] = static_cast<uint8_t>(lead);
+        ref.xor_bits[channel] = static_cast<uint8_t>(bits);
+    }
+    
+    static bool get_xor(BitReader& in, DeltaState& ref, int channel) {
+        uint32_t control, lead, bits, x;
+        if (!in.get(1, &control)) return false;
+        if (control) {
+            if (!in.get(4, &lead) || !in.get(4, &bits)) return false;
+            ref.xor_lead[channel] = static_cast<uint8_t>(lead);
+            ref.xor_bits[channel] = static_cast<uint8_t>(bits + 1);
+        } else if (ref.xor_bits[channel] == 0) {
+            return false;
+        }
+        int width = ref.xor_bits[channel];
+        if (!in.get(width, &x)) return false;
+        ref.value[channel] ^= static_cast<uint16_t>(x << (16 - ref.xor_lead[channel] - width));
+        return true;
+    }
+    
+    // Delta log record, framed as varint(length) + payload:
+    //   'K' keyframe: varint cycle, varint time_us, every channel as a varint.
+    //       Resets all references, so decoding can start at any keyframe.
+    //   'D' delta: varint cycle step, zigzag time delta-of-delta, varint
+    //       changed count, varint index gap per changed channel, zigzag value
+    //       delta per digital channel, then the XOR bit stream for the
+    //       analog ones (byte padded).
+    // A scan where no channel moved past its deadband is not stored at all.
+    // Returns the framed length, 0 if skipped; *keyframe tells the caller
+    // where decoding may start.
+    static size_t encode_delta_record(const DeltaLogHeader& header, DeltaState& ref,
+                                      const LogRecord& record, uint8_t* out, bool* keyframe) {
+        uint8_t payload[LOG_DELTA_RECORD_MAX];
+        uint8_t* p = payload;
+        
+        *keyframe = !ref.primed || record.cycle - ref.keyframe_cycle >= header.keyframe_cycles;
+        if (*keyframe) {
+            *p++ = 'K';
+            put_varint(p, record.cycle);
+            put_varint(p, static_cast<uint64_t>(record.time_us));
+            for (int ch = 0; ch < LOG_CHANNELS; ch++) {
+                ref.value[ch] = log_channel_value(record, ch);
+                put_varint(p, ref.value[ch]);
+            }
+            memset(ref.xor_bits, 0, sizeof(ref.xor_bits));
+            ref.primed = true;
+            ref.keyframe_cycle = record.cycle;
+            ref.interval_us = 0;
+        } else {
+            int changed[LOG_CHANNELS];
+            int count = 0;
+            for (int ch = 0; ch < LOG_CHANNELS; ch++) {
+                uint16_t value = log_channel_value(record, ch);
+                uint16_t diff = value > ref.value[ch] ? value - ref.value[ch] : ref.value[ch] - value;
+                if (diff > header.deadband[ch]) {
+                    changed[count++] = ch;
+                }
+            }
+            if (count == 0) return 0;
+            
+            int64_t interval = record.time_us - ref.time_us;
+            *p++ = 'D';
+            put_varint(p, record.cycle - ref.cycle);
+            put_varint(p, zigzag(interval - ref.interval_us));
+            put_varint(p, count);
+            int previous = -1;
+            for (int i = 0; i < count; i++) {
+                put_varint(p, changed[i] - previous - 1);
+                previous = changed[i];
+            }
+            for (int i = 0; i < count; i++) {
+                int ch = changed[i];
+                if (header.analog[ch]) continue;
+                uint16_t value = log_channel_value(record, ch);
+                put_varint(p, zigzag(static_cast<int64_t>(value) - ref.value[ch]));
+                ref.value[ch] = value;
+            }
+            BitWriter bits(p);
+            for (int i = 0; i < count; i++) {
+                int ch = changed[i];
+                if (!header.analog[ch]) continue;
+                uint16_t value = log_channel_value(record, ch);
+                put_xor(bits, ref, ch, value);
+                ref.value[ch] = value;
+            }
+            p = bits.finish();
+            ref.interval_us = interval;
+        }
+        ref.cycle = record.cycle;
+        ref.time_us = record.time_us;
+        
+        uint8_t* framed = out;
+        put_varint(framed, p - payload);
+        memcpy(framed, payload, p - payload);
+        return (framed - out) + (p - payload);
+    }
+    
+    // Inverse of encode_delta_record(): one payload into `record`, which
+    // keeps every value not in the payload from the previous record
+    static bool decode_delta_record(const DeltaLogHeader& header, DeltaState& ref,
+                                    const uint8_t* p, const uint8_t* end, LogRecord& record) {
+        uint64_t v;
+        if (p >= end) return false;
+        uint8_t kind = *p++;
+        if (kind == 'K') {
+            uint64_t cycle, time_us;
+            if (!get_varint(p, end, &cycle) || !get_varint(p, end, &time_us)) return false;
+            for (int ch = 0; ch < LOG_CHANNELS; ch++) {
+                if (!get_varint(p, end, &v)) return false;
+                ref.value[ch] = static_cast<uint16_t>(v);
+            }
+            memset(ref.xor_bits, 0, sizeof(ref.xor_bits));
+            ref.primed = true;
+            ref.cycle = static_cast<uint32_t>(cycle);
+            ref.time_us = static_cast<int64_t>(time_us);
+            ref.interval_us = 0;
+        } else if (kind == 'D' && ref.primed) {
+            uint64_t step, dod, count;
+            if (!get_varint(p, end, &step) || !get_varint(p, end, &dod) || !get_varint(p, end, &count) ||
+                count > static_cast<uint64_t>(LOG_CHANNELS)) {
+                return false;
+            }
+            int changed[LOG_CHANNELS];
+            int previous = -1;
+            for (uint64_t i = 0; i < count; i++) {
+                if (!get_varint(p, end, &v) || previous + 1 + v >= static_cast<uint64_t>(LOG_CHANNELS)) return false;
+                previous = changed[i] = static_cast<int>(previous + 1 + v);
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                int ch = changed[i];
+                if (header.analog[ch]) continue;
+                if (!get_varint(p, end, &v)) return false;
+                ref.value[ch] = static_cast<uint16_t>(ref.value[ch] + unzigzag(v));
+            }
+            BitReader bits(p, end);
+            for (uint64_t i = 0; i < count; i++) {
+                if (header.analog[changed[i]] && !get_xor(bits, ref, changed[i])) return false;
+            }
+            ref.interval_us += unzigzag(dod);
+            ref.cycle += static_cast<uint32_t>(step);
+            ref.time_us += ref.interval_us;
+        } else {
+            return false;
+        }
+        
+        record.cycle = ref.cycle;
+        record.time_us = ref.time_us;
+        for (int ch = 0; ch < LOG_CHANNELS; ch++) {
+            set_log_channel(record, ch, ref.value[ch]);
+        }
+        return true;
+    }
+    
+    // Stream header the configured format starts a segment with
+    size_t build_stream_header(char* out) {
+        if (config.log_format == PLCConfig::LOG_DELTA) {
+            memcpy(out, &delta_header, sizeof(delta_header));
+            return sizeof(delta_header);
+        }
+        LogFileHeader header;
+        fill_log_header(header, "PLCLOG1", config.scan_period_ms);
+        memcpy(out, &header, sizeof(header));
+        return sizeof(header);
+    }
+    
+    // "plc_data.<sequence>.<ext>" files in dir, oldest first
+    static void list_segments(const std::string& dir, std::vector<SegmentFile>& segments) {
+        segments.clear();
+        DIR* d = opendir(dir.c_str());
+        if (d == nullptr) return;
+        while (struct dirent* entry = readdir(d)) {
+            unsigned sequence;
+            char ext[8];
+            if (sscanf(entry->d_name, "plc_data.%u.%7s", &sequence, ext) != 2) continue;
+            if (strcmp(ext, "bin") != 0 && strcmp(ext, "dlog") != 0 && strcmp(ext, "log") != 0) continue;
+            SegmentFile file;
+            file.sequence = sequence;
+            file.path = dir + "/" + entry->d_name;
+            struct stat info;
+            if (stat(file.path.c_str(), &info) != 0) continue;
+            file.size = info.st_size;
+            file.modified = info.st_mtime;
+            segments.push_back(file);
+        }
+        closedir(d);
+        std::sort(segments.begin(), segments.end());
+    }
+    
+    // mkdir -p
+    static bool make_directories(const std::string& path) {
+        for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+            std::string prefix = path.substr(0, slash);
+            if (mkdir(prefix.c_str(), 0755) != 0 && errno != EEXIST) return false;
+            if (slash == std::string::npos) return true;
+        }
+    }
+    
+    std::string segment_path(uint32_t sequence) const {
+        char name[48];
+        snprintf(name, sizeof(name), "/plc_data.%06u%s", sequence, log_file_extension(config.log_format));
+        return log_dir + name;
+    }
+    
+    std::string snapshot_path() const { return log_dir + "/plc_state.snap"; }
+    
+    static uint32_t snapshot_checksum(const SnapshotSlot& slot) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&slot);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < offsetof(SnapshotSlot, checksum); i++) hash = (hash ^ p[i]) * 16777619u;
+        return hash;
+    }
+    
+    // Map the snapshot file (creating it on first start) and restore the
+    // newest intact slot into the process image - one page copied, so a
+    // restarted node resumes from its retained memory on its first scan.
+    // Returns true for a warm restart.
+    bool restore_snapshot() {
+        if (config.snapshot_ms <= 0 || log_dir.empty()) return false;
+        std::string path = snapshot_path();
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 ||
+            (st.st_size < static_cast<off_t>(sizeof(SnapshotFile)) && ftruncate(fd, sizeof(SnapshotFile)) != 0)) {
+            console.warning("Snapshot disabled - cannot open %s: %s", path.c_str(), strerror(errno));
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        void* map = mmap(nullptr, sizeof(SnapshotFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            console.warning("Snapshot disabled - cannot map %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        snapshot = static_cast<SnapshotFile*>(map);
+        
+        int64_t started = monotonic_ns();
+        const uint32_t layout[4] = { MAX_OUTPUTS, MAX_REGISTERS, MAX_DISCRETE_OUTPUTS,
+                                     static_cast<uint32_t>(sizeof(SnapshotSlot)) };
+        if (memcmp(snapshot->magic, "PLCSNAP1", 8) != 0 || memcmp(snapshot->layout, layout, sizeof(layout)) != 0) {
+            // New file, or saved by a build with another process image size
+            memset(snapshot, 0, sizeof(SnapshotFile));
+            memcpy(snapshot->magic, "PLCSNAP1", 8);
+            memcpy(snapshot->layout, layout, sizeof(layout));
+            console.notice("Cold start: no snapshot in %s", path.c_str());
+            return false;
+        }
+        
+        const SnapshotSlot* newest = nullptr;
+        for (int i = 0; i < 2; i++) {
+            const SnapshotSlot& slot = snapshot->slots[i];
+            if (slot.sequence == 0 || slot.checksum != snapshot_checksum(slot)) continue;
+            if (newest == nullptr || slot.sequence - newest->sequence < 0x80000000u) newest = &slot;
+        }
+        if (newest == nullptr) {
+            console.notice("Cold start: no intact snapshot in %s", path.c_str());
+            return false;
+        }
+        memcpy(state.outputs, newest->outputs, sizeof(state.outputs));
+        memcpy(state.registers, newest->registers, sizeof(state.registers));
+        memcpy(state.discrete_outputs, newest->discrete_outputs, sizeof(state.discrete_outputs));
+        state.cycle_count = newest->cycle_count;
+        int64_t restored = monotonic_ns();
+        console.notice("Warm restart: cycle %u restored in %lldus (saved %lldms ago)", newest->cycle_count,
+                       static_cast<long long>((restored - started) / 1000),
+                       static_cast<long long>((Timestamp::now_us() - newest->time_us) / 1000));
+        return true;
+    }
+    
+    // Logging thread: write the older slot, then schedule the page for
+    // writeback - the kernel keeps it across a process crash either way
+    void save_snapshot(const SystemState& snap) {
+        const SnapshotSlot& current = snapshot->slots[0].sequence - snapshot->slots[1].sequence < 0x80000000u
+                                      ? snapshot->slots[0] : snapshot->slots[1];
+        SnapshotSlot& slot = &current == &snapshot->slots[0] ? snapshot->slots[1] : snapshot->slots[0];
+        slot.sequence = current.sequence + 1;
+        slot.cycle_count = snap.cycle_count;
+        slot.time_us = Timestamp::now_us();
+        memcpy(slot.outputs, snap.outputs, sizeof(slot.outputs));
+        memcpy(slot.registers, snap.registers, sizeof(slot.registers));
+        memcpy(slot.discrete_outputs, snap.discrete_outputs, sizeof(slot.discrete_outputs));
+        slot.checksum = snapshot_checksum(slot);
+        msync(snapshot, sizeof(SnapshotFile), MS_ASYNC);
+        snapshot_saved = monotonic_ns();
+    }
+    
+    // Pick the segment directory and continue the sequence found there. A
+    // directory that cannot be written (not deployed, no permission) falls
+    // back to /tmp so a development run still logs.
+    void start_data_log() {
+        log_dir = config.log_dir;
+        if (!make_directories(log_dir) || access(log_dir.c_str(), W_OK) != 0) {
+            std::string fallback = "/tmp/legacy-plc";
+            if (config.instance_name != nullptr) fallback = fallback + "/" + config.instance_name;
+            console.warning("Cannot write %s (%s) - logging to %s", log_dir.c_str(), strerror(errno), fallback.c_str());
+            log_dir = fallback;
+            make_directories(log_dir);
+        }
+        
+        std::vector<SegmentFile> segments;
+        list_segments(log_dir, segments);
+        log_sequence = segments.empty() ? 1 : segments.back().sequence + 1;
+        if (!segments.empty()) recover_log_segment(segments.back().path);
+        
+        if (config.log_format == PLCConfig::LOG_DELTA) init_delta_header();
+        enforce_log_retention();
+        if (open_log_segment()) {
+            console.info("Data log: %s", segment_path(log_sequence).c_str());
+        }
+    }
+    
+    // Create, preallocate and map the next segment. Every segment starts a
+    // fresh delta stream, so each can be decoded on its own.
+    bool open_log_segment() {
+        std::string path = segment_path(log_sequence);
+        memset(&delta_encoder, 0, sizeof(delta_encoder));
+        index_pending = 0;
+        last_indexed_cycle = 0;
+        segment_has_records = false;
+        segment_opened = monotonic_ns();
+        
+        if (config.log_format == PLCConfig::LOG_CSV) {
+            log_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0644);
+            if (log_fd < 0) {
+                console.error("Cannot create data log %s: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            FixedWriter header(&log_batch[0], log_batch.size());
+            header.put_literal("timestamp,cycle,error_codes");
+            put_csv_point_names(header, ",I", MAX_INPUTS);
+            put_csv_point_names(header, ",Q", MAX_OUTPUTS);
+            put_csv_point_names(header, ",MW", MAX_REGISTERS);
+            header.put('\n');
+            log_batch_used = header.length();
+            segment_size = 0;
+            flush_log_batch();
+            log_segment_current.store(log_sequence, std::memory_order_relaxed);
+            return true;
+        }
+        
+        size_t size = static_cast<size_t>(config.log_segment_mb) * 1024 * 1024;
+        log_fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (log_fd < 0) {
+            console.error("Cannot create data log %s: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+        // Allocate every block up front - a store into a sparse mapping on a
+        // full card would be SIGBUS, not an error return
+        int err = posix_fallocate(log_fd, 0, size);
+        void* map = err == 0 ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, log_fd, 0) : MAP_FAILED;
+        if (map == MAP_FAILED) {
+            console.error("Cannot preallocate data log %s: %s", path.c_str(), strerror(err ? err : errno));
+            close(log_fd);
+            unlink(path.c_str());
+            log_fd = -1;
+            return false;
+        }
+        
+        segment_map = static_cast<char*>(map);
+        segment_size = size;
+        segment = reinterpret_cast<SegmentHeader*>(segment_map);
+        segment_index = reinterpret_cast<SegmentIndexEntry*>(segment_map + SEGMENT_INDEX_OFFSET);
+        
+        memcpy(segment->magic, "PLCSEG1", 8);
+        segment->format = config.log_format;
+        segment->sequence = log_sequence;
+        segment->stream_header_size = static_cast<uint32_t>(build_stream_header(segment_map + SEGMENT_STREAM_HEADER_OFFSET));
+        segment->index_capacity = SEGMENT_INDEX_ENTRIES;
+        segment->data_offset = SEGMENT_INDEX_OFFSET + SEGMENT_INDEX_ENTRIES * sizeof(SegmentIndexEntry);
+        segment->data_capacity = size - segment->data_offset;
+        segment->created_us = Timestamp::now_us();
+        msync(segment_map, SEGMENT_INDEX_OFFSET, MS_ASYNC);
+        log_segment_current.store(log_sequence, std::memory_order_relaxed);
+        return true;
+    }
+    
+    // Mark the segment closed and give back the unused preallocation
+    void close_log_segment() {
+        if (log_fd < 0) return;
+        if (segment_map != nullptr) {
+            segment->closed = 1;
+            off_t used = static_cast<off_t>(segment->data_offset + segment->data_length);
+            msync(segment_map, used, MS_SYNC);
+            munmap(segment_map, segment_size);
+            segment_map = nullptr;
+            segment = nullptr;
+            segment_index = nullptr;
+            if (ftruncate(log_fd, used) != 0) {
+                console.warning("Cannot trim data log segment %u", log_sequence);
+            }
+        }
+        close(log_fd);
+        log_fd = -1;
+    }
+    
+    // A segment left open by a crash or power cut still holds its whole
+    // preallocation; close it at the last committed record
+    static void recover_log_segment(const std::string& path) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) return;
+        SegmentHeader header;
+        if (pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header)) &&
+            memcmp(header.magic, "PLCSEG1", 8) == 0 && !header.closed) {
+            header.closed = 1;
+            if (pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+                ftruncate(fd, static_cast<off_t>(header.data_offset + header.data_length)) != 0) {
+                console.warning("Cannot close interrupted data log %s", path.c_str());
+            }
+        }
+        close(fd);
+    }
+    
+    void rotate_log_segment() {
+        flush_log_batch();
+        close_log_segment();
+        log_sequence++;
+        enforce_log_retention();
+        open_log_segment();
+    }
+    
+    // Room for the batch plus one more record of `bytes`, and an index slot
+    bool segment_has_room(size_t bytes) const {
+        if (segment_map == nullptr) {
+            return segment_size + log_batch_used + bytes <= static_cast<size_t>(config.log_segment_mb) * 1024 * 1024;
+        }
+        return segment->data_length + log_batch_used + bytes <= segment->data_capacity &&
+               index_pending < segment->index_capacity;
+    }
+    
+    bool segment_expired() const {
+        return config.log_segment_hours > 0 && segment_has_records &&
+               monotonic_ns() - segment_opened >= static_cast<int64_t>(config.log_segment_hours) * 3600 * 1000000000LL;
+    }
+    
+    // Delete the oldest closed segments beyond the size or age limit. Runs
+    // between segments, so the next one's full preallocation is budgeted.
+    void enforce_log_retention() {
+        std::vector<SegmentFile> segments;
+        list_segments(log_dir, segments);
+        
+        uint64_t total = static_cast<uint64_t>(config.log_segment_mb) * 1024 * 1024;
+        for (size_t i = 0; i < segments.size(); i++) total += segments[i].size;
+        const uint64_t limit = static_cast<uint64_t>(config.log_retention_mb) * 1024 * 1024;
+        const time_t oldest = time(nullptr) - static_cast<time_t>(config.log_retention_days) * 86400;
+        
+        for (size_t i = 0; i < segments.size(); i++) {
+            bool over_size = config.log_retention_mb > 0 && total > limit;
+            bool too_old = config.log_retention_days > 0 && segments[i].modified < oldest;
+            if (!over_size && !too_old) break;
+            if (unlink(segments[i].path.c_str()) == 0) {
+                total -= segments[i].size;
+            }
+        }
+    }
+    
+    static void put_csv_point_names(FixedWriter& out, const char* prefix, int count) {
+        for (int i = 0; i < count; i++) {
+            out.put(prefix);
+            out.put_uint(i);
+        }
+    }
+    
+    // One CSV row: local time with milliseconds, cycle, error bits, all points
+    static size_t format_csv_record(const LogRecord& record, char* buffer, size_t capacity) {
+        char timestamp[32];
+        size_t timestamp_len = Timestamp::local_ms(record.time_us, timestamp, sizeof(timestamp));
+        
+        FixedWriter row(buffer, capacity);
+        row.put(timestamp, timestamp_len);
+        row.put(',');
+        row.put_uint(record.cycle);
+        row.put(',');
+        row.put_uint(record.error_codes);
+        for (int i = 0; i < MAX_INPUTS; i++) { row.put(','); row.put_uint(record.inputs[i]); }
+        for (int i = 0; i < MAX_OUTPUTS; i++) { row.put(','); row.put_uint(record.outputs[i]); }
+        for (int i = 0; i < MAX_REGISTERS; i++) { row.put(','); row.put_uint(record.registers[i]); }
+        row.put('\n');
+        return row.length();
+    }
+    
+    // Logging thread: move every queued scan into the write batch, rotating
+    // at record boundaries so no record or delta chain spans two segments
+    void drain_log_ring() {
+        const size_t needed = config.log_format == PLCConfig::LOG_CSV ? LOG_CSV_LINE_MAX :
+                              config.log_format == PLCConfig::LOG_DELTA ? LOG_DELTA_RECORD_MAX : sizeof(LogRecord);
+        while (const LogRecord* record = log_ring.front()) {
+            append_history(*record);
+            if (log_fd >= 0 && (!segment_has_room(needed) || segment_expired())) {
+                rotate_log_segment();
+            }
+            if (log_fd < 0) {
+                // No segment (directory unwritable, card full) - the sample is lost
+                log_ring.pop();
+                log_records_dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            if (log_batch.size() - log_batch_used < needed) flush_log_batch();
+            
+            char* dst = &log_batch[log_batch_used];
+            size_t length;
+            bool index_here = false;
+            if (config.log_format == PLCConfig::LOG_CSV) {
+                length = format_csv_record(*record, dst, needed);
+            } else if (config.log_format == PLCConfig::LOG_DELTA) {
+                length = encode_delta_record(delta_header, delta_encoder, *record,
+                                             reinterpret_cast<uint8_t*>(dst), &index_here);
+            } else {
+                memcpy(dst, record, sizeof(LogRecord));
+                length = sizeof(LogRecord);
+                index_here = index_pending == 0 || record->cycle - last_indexed_cycle >= LOG_KEYFRAME_CYCLES;
+            }
+            
+            if (length > 0) {
+                if (index_here && segment_map != nullptr) {
+                    SegmentIndexEntry& entry = segment_index[index_pending++];
+                    entry.cycle = record->cycle;
+                    entry.reserved = 0;
+                    entry.offset = segment->data_length + log_batch_used;
+                    entry.time_us = record->time_us;
+                    last_indexed_cycle = record->cycle;
+                }
+                if (!segment_has_records && segment_map != nullptr) {
+                    segment->first_cycle = record->cycle;
+                    segment->first_time_us = record->time_us;
+                }
+                segment_has_records = true;
+                batch_last_cycle = record->cycle;
+                batch_last_time_us = record->time_us;
+                if (log_batch_used == 0) log_batch_started = monotonic_ns();
+                log_batch_used += length;
+            }
+            log_ring.pop();
+            log_records_written.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    
+    // Commit the batch to the segment in one go: a single copy into the
+    // mapping (the kernel writes it back in large chunks) followed by the
+    // header update, or one write() for CSV segments. A failed CSV write
+    // drops the batch rather than letting a dead card back the ring up.
+    void flush_log_batch() {
+        if (log_batch_used == 0 || log_fd < 0) {
+            log_batch_used = 0;
+            return;
+        }
+        int64_t started = monotonic_ns();
         
-        // Load "ladder logic" simulation
-        load_control_program();
-        
-        state.running = true;
-        last_cycle = std::chrono::steady_clock::now();
+        if (segment_map != nullptr) {
+            uint64_t start = segment->data_offset + segment->data_length;
+            memcpy(segment_map + start, &log_batch[0], log_batch_used);
+            segment->data_length += log_batch_used;
+            segment->index_count = index_pending;
+            segment->last_cycle = batch_last_cycle;
+            segment->last_time_us = batch_last_time_us;
+            
+            uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+            uint64_t aligned = start & ~(page - 1);
+            msync(segment_map + aligned, start + log_batch_used - aligned, MS_ASYNC);
+            msync(segment_map, SEGMENT_INDEX_OFFSET + index_pending * sizeof(SegmentIndexEntry), MS_ASYNC);
+            log_batches_written.fetch_add(1, std::memory_order_relaxed);
+            log_bytes_written.fetch_add(static_cast<uint32_t>(log_batch_used), std::memory_order_relaxed);
+            log_batch_used = 0;
+            log_write_latency.record(started, monotonic_ns());
+            return;
+        }
         
-        std::cout << "System initialized. Starting scan cycle..." << std::endl;
+        size_t done = 0;
+        while (done < log_batch_used) {
+            ssize_t n = write(log_fd, &log_batch[done], log_batch_used - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                if (!log_write_failed) {
+                    console.error("Data log write failed: %s", strerror(errno));
+                    log_write_failed = true;
+                }
+                break;
+            }
+            done += n;
+        }
+        segment_size += done;
+        if (done == log_batch_used) {
+            log_batches_written.fetch_add(1, std::memory_order_relaxed);
+            log_bytes_written.fetch_add(static_cast<uint32_t>(done), std::memory_order_relaxed);
+            log_write_failed = false;
+        }
+        log_batch_used = 0;
+        log_write_latency.record(started, monotonic_ns());
     }
     
-    void setup_network() {
-        std::cout << "Setting up multi-protocol industrial network..." << std::endl;
-        
-        // Setup control protocol (legacy ASCII)
-        setup_control_protocol();
-        
-        // Setup management protocol (HTTP/JSON)
-        setup_management_protocol();
-        
-        std::cout << "? Multi-protocol binding complete" << std::endl;
+    void display_status(const SystemState& snap) {
+        char timestamp[32];
+        Timestamp::local(timestamp, sizeof(timestamp));
+        console.info("[%s] %s%sCycle: %u | Temp: %u | Heater: %s | Errors: 0x%x", timestamp,
+                     config.instance_name != nullptr ? config.instance_name : "",
+                     config.instance_name != nullptr ? " | " : "",
+                     snap.cycle_count, snap.inputs[0], snap.outputs[0] ? "ON" : "OFF", (int)snap.error_codes);
     }
     
-    void setup_control_protocol() {
-        server_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_socket < 0) {
-            std::cerr << "Failed to create control socket" << std::endl;
-            return;
+    // Logging thread - file and console output never run on the scan thread.
+    // Works from its own snapshot channel, so a slow SD card or a busy journal
+    // only ever delays this thread.
+    void logging_loop() {
+        while (logging.load(std::memory_order_acquire)) {
+            log_wakeup->wait(500);
+            service_data_log();
         }
         
-        // Make socket non-blocking for legacy-style polling
-        int flags = fcntl(server_socket, F_GETFL, 0);
-        fcntl(server_socket, F_SETFL, flags | O_NONBLOCK);
-        
-        // Reuse address
-        int opt = 1;
-        setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-        
-        server_addr.sin_family = AF_INET;
+        // Scan thread has stopped - nothing more will be queued
+        finish_data_log();
+    }
+    
+    // One pass of the logging thread's work, also run by the PLCHost log thread
+    void service_data_log() {
+        // Every scan is logged; the disk only sees full batches, or one
+        // write per flush interval when the rate is low
+        drain_log_ring();
+        if (log_batch_used > 0 && monotonic_ns() - log_batch_started >= LOG_FLUSH_INTERVAL_NS) {
+            flush_log_batch();
+        }
         
-#ifdef VIRTUAL_HARDWARE
-        // Virtual mode - different port to avoid conflicts
-        server_addr.sin_addr.s_addr = INADDR_ANY;
-        server_addr.sin_port = htons(9901);
-        std::cout << "? Control Protocol: 0.0.0.0:9901 (virtual - legacy ASCII)" << std::endl;
-#else
-        // Physical Pi - system-level binding (let infrastructure control access)
-        server_addr.sin_addr.s_addr = INADDR_ANY;  // Bind to all interfaces
-        server_addr.sin_port = htons(TCP_PORT);    // Port 9001
-        std::cout << "? Control Protocol: 0.0.0.0:9001 (legacy ASCII - system-level binding)" << std::endl;
-        std::cout << "  Network access controlled by VLAN configuration" << std::endl;
-#endif
+        if (!log_channel.update()) return;
+        const SystemState& snap = log_channel.read_slot();
         
-        if (bind(server_socket, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-            std::cerr << "Failed to bind control socket" << std::endl;
-            return;
+        if (snapshot != nullptr &&
+            monotonic_ns() - snapshot_saved >= static_cast<int64_t>(config.snapshot_ms) * 1000000LL) {
+            save_snapshot(snap);
         }
         
-        listen(server_socket, 1);  // Only one connection (typical of legacy)
+        // Status display (~5 seconds, wall-clock interval independent of the
+        // scan period) - by interval, so a late wakeup that skipped the exact
+        // multiple still displays once
+        const uint32_t display_every = scans_per(5000);
+        if (snap.cycle_count / display_every != last_displayed / display_every) {
+            display_status(snap);
+            last_displayed = snap.cycle_count;
+        }
     }
     
-    void setup_management_protocol() {
-        mgmt_socket = socket(AF_INET, SOCK_STREAM, 0);
-        if (mgmt_socket < 0) {
-            std::cerr << "Failed to create management socket" << std::endl;
-            return;
+    void finish_data_log() {
+        drain_log_ring();
+        flush_log_batch();
+        // Clean stop: the final scan is what a restart resumes from
+        if (snapshot != nullptr) {
+            log_channel.update();
+            save_snapshot(log_channel.read_slot());
         }
+    }
+    
+    // MAST scans in the given interval (at least one)
+    uint32_t scans_per(int interval_ms) const {
+        int scans = interval_ms / config.scan_period_ms;
+        return scans > 0 ? static_cast<uint32_t>(scans) : 1;
+    }
+    
+    void shutdown_system() {
+        console.notice("Shutting down PLC...");
+        stop();
+        state.running = false;
         
-        // Make socket non-blocking
-        int flags = fcntl(mgmt_socket, F_GETFL, 0);
-        fcntl(mgmt_socket, F_SETFL, flags | O_NONBLOCK);
+        while (!sessions.empty()) {
+            close_session(sessions.back());
+        }
+        // The retired sessions return to the pool, which goes with the instance
+        reactor.release_retired();
+        for (int proto = 0; proto < 3; proto++) {
+            for (size_t i = 0; i < idle_sessions[proto].size(); i++) delete idle_sessions[proto][i];
+            idle_sessions[proto].clear();
+        }
+        stop_watch.stop(reactor);
         
-        // Reuse address
-        int opt = 1;
-        setsockopt(mgmt_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (server_socket >= 0) {
+            close(server_socket);
+        }
         
-        mgmt_addr.sin_family = AF_INET;
-        mgmt_addr.sin_addr.s_addr = INADDR_ANY;  // System-level binding
+        if (mgmt_socket >= 0) {
+            close(mgmt_socket);
+        }
         
-#ifdef VIRTUAL_HARDWARE
-        mgmt_addr.sin_port = htons(8901);  // Different port for virtual
-        std::cout << "? Management Interface: 0.0.0.0:8901 (virtual - HTTP/JSON)" << std::endl;
-#else
-        mgmt_addr.sin_port = htons(MGMT_PORT);  // Port 8080
-        std::cout << "? Management Interface: 0.0.0.0:8080 (HTTP/JSON status)" << std::endl;
-        std::cout << "  Accessible via management VLAN for monitoring/configuration" << std::endl;
-#endif
+        if (modbus_socket >= 0) {
+            close(modbus_socket);
+        }
         
-        if (bind(mgmt_socket, (struct sockaddr*)&mgmt_addr, sizeof(mgmt_addr)) < 0) {
-            std::cerr << "Failed to bind management socket" << std::endl;
-            close(mgmt_socket);
-            mgmt_socket = -1;
-            return;
+        close_log_segment();
+        if (snapshot != nullptr) {
+            munmap(snapshot, sizeof(SnapshotFile));
+            snapshot = nullptr;
         }
         
-        listen(mgmt_socket, 3);  // Allow more concurrent management connections
+        console.notice("Total cycles executed: %u", state.cycle_count);
     }
     
-    void load_control_program() {
-        // Simulate loading "ladder logic" - typical startup sequence
-        std::cout << "Loading control program..." << std::endl;
-        usleep(500000); // 500ms load time
+    bool is_running() const { return running.load(std::memory_order_acquire); }
+    
+    // Offline conversion of a segment file, or every segment in a directory,
+    // to CSV on stdout. With from_cycle the segment index is used to start
+    // decoding at the last entry at or before it.
+    static int export_log_csv(const char* path, uint32_t from_cycle) {
+        std::vector<SegmentFile> segments;
+        struct stat info;
+        if (stat(path, &info) == 0 && S_ISDIR(info.st_mode)) {
+            list_segments(path, segments);
+        } else {
+            SegmentFile file;
+            file.sequence = 0;
+            file.path = path;
+            file.size = 0;
+            file.modified = 0;
+            segments.push_back(file);
+        }
         
-        // Initialize some default register values (typical configuration)
-        state.registers[0] = 100;   // Setpoint temperature
-        state.registers[1] = 50;    // Alarm threshold
-        state.registers[2] = 1000;  // Timer preset
-        state.registers[10] = 0x1234; // Device ID
+        std::cout << "timestamp,cycle,error_codes";
+        for (int i = 0; i < MAX_INPUTS; i++) std::cout << ",I" << i;
+        for (int i = 0; i < MAX_OUTPUTS; i++) std::cout << ",Q" << i;
+        for (int i = 0; i < MAX_REGISTERS; i++) std::cout << ",MW" << i;
+        std::cout << '\n';
         
-        std::cout << "Program loaded. Memory usage: 2KB/64KB" << std::endl;
+        int failures = 0;
+        for (size_t i = 0; i < segments.size(); i++) {
+            if (!export_segment_csv(segments[i].path.c_str(), from_cycle)) failures++;
+        }
+        std::cout.flush();
+        return failures == 0 ? 0 : 1;
     }
     
-    void run_scan_cycle() {
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_cycle);
+    static bool export_segment_csv(const char* path, uint32_t from_cycle) {
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            std::cerr << "Cannot read " << path << std::endl;
+            if (fd >= 0) close(fd);
+            return false;
+        }
         
-        if (elapsed.count() >= CYCLE_TIME_MS) {
-            // Input scan phase
-            scan_inputs();
-            
-            // Program execution phase
-            execute_control_logic();
-            
-            // Output update phase  
-            update_outputs();
-            
-            // Communication phase (legacy style - poll for connections)
-            handle_network_communication();
-            
-            // Data logging phase
-            log_cycle_data();
-            
-            state.cycle_count++;
-            last_cycle = now;
-            
-            // Status display (every 50 cycles = ~5 seconds)
-            if (state.cycle_count % 50 == 0) {
-                display_status();
+        size_t size = static_cast<size_t>(info.st_size);
+        if (strlen(path) >= 4 && memcmp(path + strlen(path) - 4, ".log", 4) == 0) {
+            // CSV segment - already in export form, minus its header row
+            std::ifstream text(path);
+            std::string line;
+            std::getline(text, line);
+            while (std::getline(text, line)) {
+                uint32_t cycle = 0;
+                const char* comma = strchr(line.c_str(), ',');
+                if (comma != nullptr) cycle = static_cast<uint32_t>(strtoul(comma + 1, nullptr, 10));
+                if (cycle >= from_cycle) std::cout << line << '\n';
             }
+            close(fd);
+            return true;
         }
-    }
-    
-    void scan_inputs() {
-        // Simulate input scanning with enhanced virtual behavior
         
-#ifdef VIRTUAL_HARDWARE
-        // More realistic simulation for virtual cluster testing
-        static double temp_simulation = 750.0;
-        static double pressure_simulation = 500.0;
-        static uint32_t cycle_input_period = 200;  // Fixed: use uint32_t to match cycle_count type
-        
-        // Temperature with more complex behavior in virtual mode
-        temp_simulation += (std::sin(state.cycle_count * 0.1) * 2) + ((rand() % 20) - 10) * 0.1;
-        if (temp_simulation < 600) temp_simulation = 600;
-        if (temp_simulation > 900) temp_simulation = 900;
-        state.inputs[0] = static_cast<uint16_t>(temp_simulation);
-        
-        // Pressure with virtual drift
-        pressure_simulation += (rand() % 6) - 3; // Random walk
-        if (pressure_simulation < 400) pressure_simulation = 400;
-        if (pressure_simulation > 600) pressure_simulation = 600;
-        state.inputs[3] = static_cast<uint16_t>(pressure_simulation);
-        
-        // Cycle input with configurable period in virtual mode  
-        state.inputs[1] = (state.cycle_count % cycle_input_period < cycle_input_period / 2) ? 1 : 0;
+        void* map = size >= sizeof(SegmentHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if (map == MAP_FAILED) {
+            std::cerr << "Not a data log segment: " << path << std::endl;
+            return false;
+        }
+        const char* base = static_cast<const char*>(map);
+        const SegmentHeader& header = *reinterpret_cast<const SegmentHeader*>(base);
         
-        // Always-on input (run enable) - can be controlled via external file in virtual mode
-        state.inputs[2] = 1; // Default enabled
+        LogFileHeader expected;
+        fill_log_header(expected, header.format == PLCConfig::LOG_DELTA ? "PLCLOGD" : "PLCLOG1", 0);
+        const LogFileHeader& stream = *reinterpret_cast<const LogFileHeader*>(base + SEGMENT_STREAM_HEADER_OFFSET);
+        bool valid = memcmp(header.magic, "PLCSEG1", 8) == 0 &&
+                     header.data_offset + header.data_length <= size &&
+                     SEGMENT_INDEX_OFFSET + header.index_count * sizeof(SegmentIndexEntry) <= header.data_offset &&
+                     log_header_compatible(stream, expected);
+        if (!valid) {
+            std::cerr << "Not a data log segment from this build: " << path << std::endl;
+            munmap(map, size);
+            return false;
+        }
         
-        // Check for virtual control file
-        struct stat buffer;
-        if (stat("/tmp/plc_stop", &buffer) == 0) {
-            state.inputs[2] = 0; // Stop if file exists
+        // Seek with the index
+        const SegmentIndexEntry* index = reinterpret_cast<const SegmentIndexEntry*>(base + SEGMENT_INDEX_OFFSET);
+        uint64_t offset = 0;
+        for (uint32_t i = 0; i < header.index_count && index[i].cycle <= from_cycle; i++) {
+            offset = index[i].offset;
         }
         
-#else
-        // Original simulation for hardware builds
-        state.inputs[0] = 750 + (rand() % 100); // Temperature sensor (raw ADC)
-        state.inputs[1] = (state.cycle_count % 200 < 100) ? 1 : 0; // Cycle input
-        state.inputs[2] = 1; // Always-on input (run enable)
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(base + header.data_offset) + offset;
+        const uint8_t* end = reinterpret_cast<const uint8_t*>(base + header.data_offset) + header.data_length;
+        LogRecord record;
+        memset(&record, 0, sizeof(record));
+        char row[LOG_CSV_LINE_MAX];
         
-        // Simulate pressure sensor with drift
-        static int pressure_base = 500;
-        pressure_base += (rand() % 3) - 1; // Random walk
-        state.inputs[3] = pressure_base;
-#endif
+        if (header.format == PLCConfig::LOG_DELTA) {
+            const DeltaLogHeader& delta = *reinterpret_cast<const DeltaLogHeader*>(base + SEGMENT_STREAM_HEADER_OFFSET);
+            DeltaState ref;
+            memset(&ref, 0, sizeof(ref));
+            uint64_t length;
+            while (get_varint(p, end, &length) && length <= static_cast<uint64_t>(end - p)) {
+                if (decode_delta_record(delta, ref, p, p + length, record) && record.cycle >= from_cycle) {
+                    std::cout.write(row, format_csv_record(record, row, sizeof(row)));
+                }
+                p += length;
+            }
+        } else {
+            for (; p + sizeof(LogRecord) <= end; p += sizeof(LogRecord)) {
+                memcpy(&record, p, sizeof(record));
+                if (record.cycle >= from_cycle) {
+                    std::cout.write(row, format_csv_record(record, row, sizeof(row)));
+                }
+            }
+        }
+        munmap(map, size);
+        return true;
     }
     
-    void execute_control_logic() {
-        // Simulate ladder logic execution - very simple control program
-        // This mimics early 2000s PLC programming style
+    // Launch the scan and logging threads; the caller's thread then services
+    // communications through handle_network_communication()
+    void start() {
+        // Termination signals are left to the calling thread, so they
+        // interrupt its reactor wait rather than a worker
+        sigset_t stop_signals, previous;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        sigaddset(&stop_signals, SIGUSR1);
+        sigaddset(&stop_signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
         
-        // Rung 1: Run enable logic
-        bool run_enable = (state.inputs[2] == 1);
+        running.store(true, std::memory_order_release);
+        logging.store(true, std::memory_order_release);
+        scan_thread = std::thread(&LegacyPLC::scan_loop, this);
+        log_thread = std::thread(&LegacyPLC::logging_loop, this);
         
-        // Rung 2: Temperature control
-        if (run_enable && state.inputs[0] < state.registers[0]) {
-            state.outputs[0] = 1; // Heater on
-        } else {
-            state.outputs[0] = 0; // Heater off
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+    
+    // Scan thread first, so its last scan is queued before the logging
+    // thread drains the ring for the final time
+    void stop() {
+        running.store(false, std::memory_order_release);
+        if (scan_thread.joinable()) scan_thread.join();
+        logging.store(false, std::memory_order_release);
+        if (log_wakeup != nullptr) log_wakeup->signal();
+        if (log_thread.joinable()) log_thread.join();
+    }
+};
+
+// Scan executor for hosted instances. A dispatcher thread keeps every idle
+// instance in a heap by next release and sleeps on a timerfd armed at the
+// earliest one. A released instance becomes a job with deadline release +
+// its shortest task period, queued on the worker that last ran it (warm
+// caches). Workers run their own earliest-deadline job first; an idle
+// worker steals the earliest-deadline job from whichever queue holds it, so
+// a slow instance never strands the others behind it. An instance is in
+// at most one queue at a time and is re-armed only after its job returns,
+// so no two workers ever scan the same controller.
+class ScanExecutor {
+public:
+    ScanExecutor(const std::vector<LegacyPLC*>& instances, int worker_count,
+                 int rt_priority, int cpu)
+        : instances(instances), workers(worker_count), rt_priority(rt_priority), cpu(cpu),
+          timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+          armed_release(INT64_MAX), running(false), last_worker(instances.size()) {
+        for (size_t i = 0; i < instances.size(); i++) {
+            last_worker[i] = static_cast<int>(i % workers.size());
         }
-        
-        // Rung 3: High temperature alarm
-        if (state.inputs[0] > state.registers[1]) {
-            state.outputs[1] = 1; // Alarm on
-            state.error_codes |= 0x01; // Set alarm bit
-        } else {
-            state.outputs[1] = 0;
-            state.error_codes &= ~0x01; // Clear alarm bit
+    }
+    
+    ~ScanExecutor() {
+        stop();
+        if (timer_fd >= 0) close(timer_fd);
+    }
+    
+    bool start() {
+        if (timer_fd < 0) {
+            console.error("Failed to create the scan dispatcher timer");
+            return false;
         }
-        
-        // Rung 4: Cycle counter output
-        state.registers[20] = state.cycle_count & 0xFFFF;
-        
-        // Rung 5: Status LED (heartbeat)
-        state.outputs[15] = (state.cycle_count % 10 < 5) ? 1 : 0;
+        running.store(true, std::memory_order_release);
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].thread = std::thread(&ScanExecutor::worker_loop, this, static_cast<int>(w));
+        }
+        dispatcher = std::thread(&ScanExecutor::dispatch_loop, this);
+        return true;
     }
     
-    void update_outputs() {
-        // In real PLC, this would update physical outputs
-        // Here we just ensure internal consistency
+    void stop() {
+        if (!running.exchange(false)) return;
+        dispatch_wakeup.signal();
+        if (dispatcher.joinable()) dispatcher.join();
+        for (size_t w = 0; w < workers.size(); w++) {
+            workers[w].wakeup.signal();
+            if (workers[w].thread.joinable()) workers[w].thread.join();
+        }
         
-        // Update some computed registers
-        state.registers[100] = state.inputs[0];  // Copy temperature to register
-        state.registers[101] = state.outputs[0]; // Copy heater status
+        uint32_t jobs = 0, stolen = 0;
+        for (size_t w = 0; w < workers.size(); w++) {
+            jobs += workers[w].jobs.load(std::memory_order_relaxed);
+            stolen += workers[w].stolen.load(std::memory_order_relaxed);
+        }
+        console.info("Scan executor: %u jobs on %zu workers, %u stolen", jobs, workers.size(), stolen);
     }
     
-    void handle_network_communication() {
-        // Handle control protocol connections (legacy ASCII)
-        handle_control_connections();
+private:
+    struct Job {
+        int64_t key;            // Deadline in a worker queue, release in the dispatcher heap
+        uint32_t instance;
+        // std::push_heap builds a max-heap - invert for earliest first
+        bool operator<(const Job& other) const { return key > other.key; }
+    };
+    
+    struct Worker {
+        std::mutex lock;
+        std::vector<Job> queue;             // Heap, earliest deadline on top
+        Notifier wakeup;
+        std::atomic<bool> idle;
+        std::thread thread;
+        std::atomic<uint32_t> jobs;
+        std::atomic<uint32_t> stolen;
+        Worker() : idle(false), jobs(0), stolen(0) {}
+    };
+    
+    struct Completion {
+        int64_t release;
+        uint32_t instance;
+        int worker;
+    };
+    
+    const std::vector<LegacyPLC*>& instances;
+    std::vector<Worker> workers;
+    int rt_priority;
+    int cpu;
+    
+    int timer_fd;
+    Notifier dispatch_wakeup;
+    std::thread dispatcher;
+    std::mutex completed_lock;          // Guards completed and armed_release
+    std::vector<Completion> completed;
+    int64_t armed_release;              // Dispatcher's next wake - completions before it signal
+    std::atomic<bool> running;
+    std::vector<int> last_worker;       // Dispatcher thread only
+    
+    void dispatch_loop() {
+        LegacyPLC::apply_realtime_settings(rt_priority, -1);
         
-        // Handle management protocol connections (HTTP/JSON)
-        handle_management_connections();
+        // Spread first releases over the period - a whole plant scanning in
+        // lockstep would queue every instance behind the others each cycle
+        std::vector<Job> pending;       // Heap by release
+        for (size_t i = 0; i < instances.size(); i++) {
+            int64_t phase = instances[i]->shortest_period_ns() * static_cast<int64_t>(i) /
+                            static_cast<int64_t>(instances.size());
+            Job job = { instances[i]->arm_task_timers(phase), static_cast<uint32_t>(i) };
+            pending.push_back(job);
+            std::push_heap(pending.begin(), pending.end());
+        }
+        
+        std::vector<Completion> returned;
+        while (running.load(std::memory_order_acquire)) {
+            // Collect finished jobs until none are left, then publish the wake
+            // time under the same lock so a later completion compares against it
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> guard(completed_lock);
+                    returned.swap(completed);
+                    if (returned.empty()) {
+                        armed_release = pending.empty() ? INT64_MAX : pending.front().key;
+                        break;
+                    }
+                }
+                for (size_t i = 0; i < returned.size(); i++) {
+                    last_worker[returned[i].instance] = returned[i].worker;
+                    Job job = { returned[i].release, returned[i].instance };
+                    pending.push_back(job);
+                    std::push_heap(pending.begin(), pending.end());
+                }
+                returned.clear();
+                release_due(pending);
+            }
+            
+            struct itimerspec timer;
+            memset(&timer, 0, sizeof(timer));
+            if (!pending.empty()) {
+                int64_t release = pending.front().key;
+                timer.it_value.tv_sec = release / 1000000000LL;
+                timer.it_value.tv_nsec = release % 1000000000LL;
+                if (timer.it_value.tv_sec == 0 && timer.it_value.tv_nsec == 0) timer.it_value.tv_nsec = 1;
+            }
+            timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &timer, nullptr);
+            
+            struct pollfd fds[2];
+            fds[0].fd = timer_fd;
+            fds[0].events = POLLIN;
+            fds[1].fd = dispatch_wakeup.fd();
+            fds[1].events = POLLIN;
+            fds[0].revents = fds[1].revents = 0;
+            if (poll(fds, 2, -1) > 0) {
+                uint64_t expirations;
+                if (fds[0].revents & POLLIN) {
+                    ssize_t ignored = read(timer_fd, &expirations, sizeof(expirations));
+                    (void)ignored;
+                }
+                if (fds[1].revents & POLLIN) dispatch_wakeup.clear();
+            }
+            release_due(pending);
+        }
     }
     
-    void handle_control_connections() {
-        // Legacy-style control protocol communication handling
-        int client_socket = accept(server_socket, nullptr, nullptr);
-        if (client_socket > 0) {
-            char buffer[256];
-            ssize_t bytes = recv(client_socket, buffer, sizeof(buffer)-1, MSG_DONTWAIT);
+    // Move every instance whose release has come into a worker queue
+    void release_due(std::vector<Job>& pending) {
+        int64_t now = monotonic_ns();
+        while (!pending.empty() && pending.front().key <= now) {
+            std::pop_heap(pending.begin(), pending.end());
+            Job job = pending.back();
+            pending.pop_back();
+            job.key += instances[job.instance]->shortest_period_ns();
             
-            if (bytes > 0) {
-                buffer[bytes] = '\0';
-                std::string response = process_legacy_command(std::string(buffer));
-                send(client_socket, response.c_str(), response.length(), 0);
+            int w = last_worker[job.instance];
+            bool busy;
+            {
+                std::lock_guard<std::mutex> guard(workers[w].lock);
+                workers[w].queue.push_back(job);
+                std::push_heap(workers[w].queue.begin(), workers[w].queue.end());
+                busy = !workers[w].idle.load(std::memory_order_relaxed) || workers[w].queue.size() > 1;
             }
+            workers[w].wakeup.signal();
             
-            close(client_socket);
+            // Its worker is occupied - rouse an idle one to steal
+            if (busy) {
+                for (size_t v = 0; v < workers.size(); v++) {
+                    if (static_cast<int>(v) != w && workers[v].idle.load(std::memory_order_relaxed)) {
+                        workers[v].wakeup.signal();
+                        break;
+                    }
+                }
+            }
         }
     }
     
-    void handle_management_connections() {
-        if (mgmt_socket < 0) return;
+    void worker_loop(int w) {
+        int pinned = cpu;
+        if (pinned >= 0) {
+            unsigned cpus = std::thread::hardware_concurrency();
+            pinned = (pinned + w) % static_cast<int>(cpus > 0 ? cpus : 1);
+        }
+        LegacyPLC::apply_realtime_settings(rt_priority, pinned);
         
-        int client_socket = accept(mgmt_socket, nullptr, nullptr);
-        if (client_socket > 0) {
-            char buffer[1024];
-            ssize_t bytes = recv(client_socket, buffer, sizeof(buffer)-1, MSG_DONTWAIT);
-            
-            if (bytes > 0) {
-                buffer[bytes] = '\0';
-                std::string response = process_http_request(std::string(buffer));
-                send(client_socket, response.c_str(), response.length(), 0);
+        Worker& self = workers[w];
+        while (running.load(std::memory_order_acquire)) {
+            Job job;
+            if (!take_job(w, &job)) {
+                self.idle.store(true, std::memory_order_relaxed);
+                if (!take_job(w, &job)) {
+                    self.wakeup.wait(100);
+                    self.idle.store(false, std::memory_order_relaxed);
+                    continue;
+                }
+                self.idle.store(false, std::memory_order_relaxed);
             }
             
-            close(client_socket);
+            Completion done;
+            done.release = instances[job.instance]->run_released_tasks();
+            done.instance = job.instance;
+            done.worker = w;
+            self.jobs.fetch_add(1, std::memory_order_relaxed);
+            
+            bool earlier;
+            {
+                std::lock_guard<std::mutex> guard(completed_lock);
+                completed.push_back(done);
+                earlier = done.release < armed_release;
+            }
+            if (earlier) dispatch_wakeup.signal();
         }
     }
     
-    std::string process_legacy_command(const std::string& command) {
-        // Process simple ASCII protocol commands (typical of early 2000s)
-        std::stringstream response;
+    // Own earliest deadline first, else steal the earliest deadline queued
+    // anywhere else
+    bool take_job(int w, Job* job) {
+        if (pop_earliest(workers[w], job)) return true;
         
-        if (command.substr(0, 2) == "RI") {
-            // Read Input - format: RI<address>
-            int addr = std::stoi(command.substr(2));
-            if (addr >= 0 && addr < MAX_INPUTS) {
-                response << std::setfill('0') << std::setw(4) << state.inputs[addr];
-            } else {
-                response << "ERR1"; // Invalid address
+        int victim = -1;
+        int64_t earliest = INT64_MAX;
+        for (size_t v = 0; v < workers.size(); v++) {
+            if (static_cast<int>(v) == w) continue;
+            std::unique_lock<std::mutex> guard(workers[v].lock, std::try_to_lock);
+            if (guard.owns_lock() && !workers[v].queue.empty() && workers[v].queue.front().key < earliest) {
+                earliest = workers[v].queue.front().key;
+                victim = static_cast<int>(v);
             }
         }
-        else if (command.substr(0, 2) == "RO") {
-            // Read Output - format: RO<address>
-            int addr = std::stoi(command.substr(2));
-            if (addr >= 0 && addr < MAX_OUTPUTS) {
-                response << std::setfill('0') << std::setw(4) << state.outputs[addr];
-            } else {
-                response << "ERR1";
-            }
+        if (victim >= 0 && pop_earliest(workers[victim], job)) {
+            workers[w].stolen.fetch_add(1, std::memory_order_relaxed);
+            return true;
         }
-        else if (command.substr(0, 2) == "RR") {
-            // Read Register - format: RR<address>
-            int addr = std::stoi(command.substr(2));
-            if (addr >= 0 && addr < MAX_REGISTERS) {
-                response << std::setfill('0') << std::setw(4) << state.registers[addr];
-            } else {
-                response << "ERR1";
+        return false;
+    }
+    
+    static bool pop_earliest(Worker& worker, Job* job) {
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if (worker.queue.empty()) return false;
+        std::pop_heap(worker.queue.begin(), worker.queue.end());
+        *job = worker.queue.back();
+        worker.queue.pop_back();
+        return true;
+    }
+};
+
+// Multi-instance host mode (--host FILE): many simulated controllers in one
+// process. Each instance keeps its own process image, program, data log and
+// sockets (ports shifted by a per-instance offset), but all of them share the
+// main thread's reactor, the ScanExecutor's workers and one log thread -
+// a 50-node virtual plant is a handful of threads instead of 150.
+//
+// Host file: one instance per line, "name [options]", with the command-line
+// options (--scan-period, --program, --log-format, ...) applied on top of
+// the host's own. "name*N" declares N identical instances name01..nameN.
+// Instances get port offsets 0, 1, 2... in file order unless a line sets
+// --port-offset, and log to <log-dir>/<name> unless it sets --log-dir. The
+// --history-mb budget is divided between all instances.
+//   # 48 line controllers and a faster packaging cell
+//   line*48     --scan-period 100
+//   packer      --scan-period 20 --fast-period 5 --program /etc/legacy-plc/packer.il
+class PLCHost {
+public:
+    static const int MAX_INSTANCES = 1000;
+    static const int LOG_POLL_MS = 50;      // Within HOSTED_LOG_RING_RECORDS of 1ms scans
+    
+    PLCHost(const PLCConfig& defaults, int workers)
+        : defaults(defaults), worker_count(workers), executor(nullptr), running(false) {}
+    
+    ~PLCHost() {
+        stop();
+        delete executor;
+        for (size_t i = 0; i < instances.size(); i++) delete instances[i];
+    }
+    
+    // Parse the host file and bring every instance up. All configurations
+    // are validated before the first instance binds a port.
+    bool load(const char* path) {
+        std::ifstream file(path);
+        if (!file) {
+            console.error("Cannot read host file %s", path);
+            return false;
+        }
+        
+        std::vector<PLCConfig> configs;
+        std::string line;
+        for (int line_number = 1; std::getline(file, line); line_number++) {
+            size_t hash = line.find('#');
+            if (hash != std::string::npos) line.erase(hash);
+            std::istringstream words(line);
+            std::vector<char*> argv;
+            argv.push_back(nullptr);    // parse_option() starts at argv[1]
+            std::string word;
+            while (words >> word) {
+                strings.push_back(word);
+                argv.push_back(&strings.back()[0]);
+            }
+            if (argv.size() == 1) continue;
+            
+            std::string name = argv[1];
+            int count = 1;
+            size_t star = name.find('*');
+            if (star != std::string::npos) {
+                if (!PLCConfig::parse_int(name.c_str() + star + 1, &count) || count < 1) {
+                    console.error("%s:%d: invalid instance count", path, line_number);
+                    return false;
+                }
+                name.erase(star);
+            }
+            if (name.empty() || configs.size() + count > static_cast<size_t>(MAX_INSTANCES)) {
+                console.error("%s:%d: invalid instance name or too many instances", path, line_number);
+                return false;
+            }
+            
+            PLCConfig config = defaults;
+            config.log_dir = nullptr;
+            config.port_offset = -1;
+            int argc = static_cast<int>(argv.size());
+            for (int i = 2; i < argc; i++) {
+                if (!config.parse_option(argc, &argv[0], i)) {
+                    console.error("%s:%d: invalid option %s", path, line_number, argv[i]);
+                    return false;
+                }
+            }
+            
+            int width = count < 100 ? 2 : 3;
+            for (int n = 1; n <= count; n++) {
+                std::ostringstream instance;
+                instance << name;
+                if (count > 1) instance << std::setw(width) << std::setfill('0') << n;
+                strings.push_back(instance.str());
+                PLCConfig copy = config;
+                copy.instance_name = strings.back().c_str();
+                // An explicit offset on a "name*N" line is the first of N
+                copy.port_offset = config.port_offset < 0 ? static_cast<int>(configs.size())
+                                                          : config.port_offset + n - 1;
+                if (copy.log_dir == nullptr) {
+                    strings.push_back(std::string(defaults.log_dir) + "/" + copy.instance_name);
+                    copy.log_dir = strings.back().c_str();
+                }
+                configs.push_back(copy);
             }
         }
-        else if (command.substr(0, 6) == "STATUS") {
-            // Status request - return fixed-width status string
-            response << "RUN," << std::setfill('0') << std::setw(8) << state.cycle_count 
-                    << "," << std::setw(2) << std::hex << (int)state.error_codes
-                    << "," << get_timestamp();
+        if (configs.empty()) {
+            console.error("Host file %s declares no instances", path);
+            return false;
         }
-        else {
-            response << "ERR0"; // Unknown command
+        
+        for (size_t i = 0; i < configs.size(); i++) {
+            configs[i].history_instances = static_cast<int>(configs.size());
+            for (size_t j = 0; j < i; j++) {
+                if (strcmp(configs[i].instance_name, configs[j].instance_name) == 0 ||
+                    configs[i].port_offset == configs[j].port_offset) {
+                    console.error("Instances %s and %s share a name or port offset",
+                                  configs[j].instance_name, configs[i].instance_name);
+                    return false;
+                }
+            }
+            if (!configs[i].validate()) {
+                console.error("Invalid configuration for instance %s", configs[i].instance_name);
+                return false;
+            }
         }
         
-        response << "\r\n"; // Legacy line ending
-        return response.str();
+        for (size_t i = 0; i < configs.size(); i++) {
+            console.info("--- Instance %s (port offset %d) ---", configs[i].instance_name, configs[i].port_offset);
+            instances.push_back(new LegacyPLC(configs[i], &reactor));
+        }
+        if (worker_count < 1 || worker_count > static_cast<int>(instances.size())) {
+            worker_count = static_cast<int>(instances.size());
+        }
+        console.info("Hosting %zu PLC instances on %d scan workers", instances.size(), worker_count);
+        return true;
     }
     
-    std::string process_http_request(const std::string& /*request*/) {
-        std::stringstream response;
-        
-        // Simple HTTP response for management interface
-        response << "HTTP/1.1 200 OK\r\n";
-        response << "Content-Type: application/json\r\n";
-        response << "Access-Control-Allow-Origin: *\r\n";
-        response << "Cache-Control: no-cache\r\n";
-        response << "Connection: close\r\n";
-        response << "\r\n";
+    bool start() {
+        // As in LegacyPLC::start() - termination signals stay with the main thread
+        sigset_t stop_signals, previous;
+        sigemptyset(&stop_signals);
+        sigaddset(&stop_signals, SIGINT);
+        sigaddset(&stop_signals, SIGTERM);
+        sigaddset(&stop_signals, SIGUSR1);
+        sigaddset(&stop_signals, SIGHUP);
+        pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
         
-        // JSON status response for management network
-        response << "{\n";
-        response << "  \"device_info\": {\n";
-        response << "    \"name\": \"Legacy PLC Simulator\",\n";
-        response << "    \"version\": \"2.1\",\n";
-        response << "    \"model\": \"Schneider/Modicon TSX Premium (circa 2004)\",\n";
-#ifdef VIRTUAL_HARDWARE
-        response << "    \"mode\": \"Virtual Hardware Simulation\",\n";
-#else
-        response << "    \"mode\": \"Physical Raspberry Pi\",\n";
-        response << "    \"hardware\": \"Pi B v2 - 512MB RAM\",\n";
-#endif
-        response << "    \"uptime_cycles\": " << state.cycle_count << "\n";
-        response << "  },\n";
-        response << "  \"operational_status\": {\n";
-        response << "    \"status\": \"" << (state.running ? "RUNNING" : "STOPPED") << "\",\n";
-        response << "    \"scan_rate_ms\": " << CYCLE_TIME_MS << ",\n";
-        response << "    \"error_codes\": \"0x" << std::hex << (int)state.error_codes << std::dec << "\",\n";
-        response << "    \"last_error\": \"" << state.last_error << "\"\n";
-        response << "  },\n";
-        response << "  \"process_data\": {\n";
-        response << "    \"inputs\": {\n";
-        response << "      \"temperature_raw\": " << state.inputs[0] << ",\n";
-        response << "      \"cycle_input\": " << state.inputs[1] << ",\n";
-        response << "      \"run_enable\": " << state.inputs[2] << ",\n";
-        response << "      \"pressure_raw\": " << state.inputs[3] << "\n";
-        response << "    },\n";
-        response << "    \"outputs\": {\n";
-        response << "      \"heater_command\": " << state.outputs[0] << ",\n";
-        response << "      \"high_temp_alarm\": " << state.outputs[1] << ",\n";
-        response << "      \"heartbeat_led\": " << state.outputs[15] << "\n";
-        response << "    },\n";
-        response << "    \"registers\": {\n";
-        response << "      \"temperature_setpoint\": " << state.registers[0] << ",\n";
-        response << "      \"alarm_threshold\": " << state.registers[1] << ",\n";
-        response << "      \"current_temperature\": " << state.registers[100] << ",\n";
-        response << "      \"heater_status\": " << state.registers[101] << "\n";
-        response << "    }\n";
-        response << "  },\n";
-        response << "  \"network_interfaces\": {\n";
-        response << "    \"control_protocol\": {\n";
-        response << "      \"endpoint\": \"*:9001\",\n";
-        response << "      \"protocol\": \"Legacy ASCII\",\n";
-        response << "      \"purpose\": \"Real-time control communications\",\n";
-#ifdef VIRTUAL_HARDWARE
-        response << "      \"vlan\": \"Virtual (No VLAN)\"\n";
-#else
-        response << "      \"vlan\": \"10 (Control Network)\"\n";
-#endif
-        response << "    },\n";
-        response << "    \"management_protocol\": {\n";
 #ifdef VIRTUAL_HARDWARE
-        response << "      \"endpoint\": \"*:8901\",\n";
-#else
-        response << "      \"endpoint\": \"*:8080\",\n";
-#endif
-        response << "      \"protocol\": \"HTTP/JSON\",\n";
-        response << "      \"purpose\": \"Status monitoring and configuration\",\n";
-#ifdef VIRTUAL_HARDWARE
-        response << "      \"vlan\": \"Virtual (No VLAN)\"\n";
-#else
-        response << "      \"vlan\": \"99 (Management Network)\"\n";
+        stop_watch.start(reactor);
 #endif
-        response << "    }\n";
-        response << "  },\n";
-        response << "  \"system_resources\": {\n";
-        response << "    \"memory_usage\": \"2KB/64KB\",\n";
-#ifdef RASPBERRY_PI
-        response << "    \"cpu_architecture\": \"ARMv6 (Pi Model B)\",\n";
-        response << "    \"memory_limit\": \"64MB (systemd)\"\n";
-#else
-        response << "    \"cpu_architecture\": \"x86_64 (Virtual)\",\n";
-        response << "    \"memory_limit\": \"Unlimited\"\n";
-#endif
-        response << "  },\n";
-        response << "  \"timestamp\": \"" << get_timestamp() << "\"\n";
-        response << "}\n";
+        executor = new ScanExecutor(instances, worker_count, defaults.rt_priority, defaults.cpu);
+        bool started = executor->start();
+        if (started) {
+            running.store(true, std::memory_order_release);
+            log_thread = std::thread(&PLCHost::log_loop, this);
+        }
         
-        return response.str();
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        return started;
     }
     
-    void log_cycle_data() {
-        // Log data in CSV format every 10 cycles (1 second)
-        if (log_file.is_open() && state.cycle_count % 10 == 0) {
-            log_file << get_timestamp() << "," << state.cycle_count;
-            
-            // Log first 4 inputs
-            for (int i = 0; i < 4; i++) {
-                log_file << "," << state.inputs[i];
-            }
-            
-            // Log first 4 outputs  
-            for (int i = 0; i < 4; i++) {
-                log_file << "," << state.outputs[i];
-            }
-            
-            log_file << "," << std::hex << (int)state.error_codes << std::endl;
-        }
+    void stop() {
+        if (executor != nullptr) executor->stop();
+        running.store(false, std::memory_order_release);
+        log_wakeup.signal();
+        if (log_thread.joinable()) log_thread.join();
+        stop_watch.stop(reactor);
     }
     
-    void display_status() {
-        std::cout << "[" << get_timestamp() << "] "
-                  << "Cycle: " << state.cycle_count
-                  << " | Temp: " << state.inputs[0] 
-                  << " | Heater: " << (state.outputs[0] ? "ON" : "OFF")
-                  << " | Errors: 0x" << std::hex << (int)state.error_codes << std::dec
-                  << std::endl;
+    // Main thread: serve every instance's sockets and publications
+    void handle_network_communication(int timeout_ms) {
+        reactor.poll(timeout_ms);
     }
     
-    std::string get_timestamp() {
-        auto now = std::chrono::system_clock::now();
-        auto time_t = std::chrono::system_clock::to_time_t(now);
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S");
-        return ss.str();
+    void dump_trace() {
+        for (size_t i = 0; i < instances.size(); i++) instances[i]->dump_trace();
     }
     
-    void shutdown_system() {
-        std::cout << "Shutting down PLC..." << std::endl;
-        state.running = false;
-        
-        if (server_socket >= 0) {
-            close(server_socket);
-        }
-        
-        if (mgmt_socket >= 0) {
-            close(mgmt_socket);
-        }
-        
-        if (log_file.is_open()) {
-            log_file << "# PLC Shutdown - " << get_timestamp() << std::endl;
-            log_file.close();
-        }
-        
-        std::cout << "Total cycles executed: " << state.cycle_count << std::endl;
+    void reload_programs() {
+        for (size_t i = 0; i < instances.size(); i++) instances[i]->reload_program();
     }
     
-    bool is_running() const { return state.running; }
+private:
+    PLCConfig defaults;
+    int worker_count;
+    Reactor reactor;                    // Outlives the instances registered with it
+    StopFileWatch stop_watch;           // On behalf of every instance
+    std::vector<LegacyPLC*> instances;
+    std::deque<std::string> strings;    // Storage behind the instances' config strings
+    ScanExecutor* executor;
+    std::atomic<bool> running;
+    std::thread log_thread;
+    Notifier log_wakeup;
+    
+    void log_loop() {
+        while (running.load(std::memory_order_acquire)) {
+            log_wakeup.wait(LOG_POLL_MS);
+            for (size_t i = 0; i < instances.size(); i++) instances[i]->service_data_log();
+        }
+        // Executor has stopped - nothing more will be queued
+        for (size_t i = 0; i < instances.size(); i++) instances[i]->finish_data_log();
+    }
 };
 
+// bench/plc_bench.cpp compiles this file with PLC_NO_MAIN and drives the
+// request, logging and scan paths directly
+#ifndef PLC_NO_MAIN
+
+// SIGINT/SIGTERM: leave the main loop so the PLC shuts down cleanly and the
+// data log batch still in memory is written
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int /*signum*/) {
+    stop_requested = 1;
+}
+
+// SIGHUP (systemd ExecReload): recompile the control program in place
+static volatile sig_atomic_t reload_requested = 0;
+
+static void request_reload(int /*signum*/) {
+    reload_requested = 1;
+}
+
+// SIGUSR1: write the phase trace rings out (--trace-events)
+static volatile sig_atomic_t trace_requested = 0;
+
+static void request_trace(int /*signum*/) {
+    trace_requested = 1;
+}
+
 // Main program
 int main(int argc, char* argv[]) {
+#if defined(MEMORY_CONSTRAINED) && defined(__GLIBC__)
+    // One malloc arena: each thread arena reserves 64MB of address space and
+    // keeps what its thread frees, and no request path allocates per request
+    mallopt(M_ARENA_MAX, 1);
+#endif
+    PLCConfig config;
+    config.load_environment();
+    const char* export_path = nullptr;
+    uint32_t from_cycle = 0;
+    const char* host_path = getenv("PLC_HOST_CONFIG");
+    if (host_path != nullptr && *host_path == '\0') host_path = nullptr;
+    int workers = 0;
+    const char* workers_env = getenv("PLC_HOST_WORKERS");
+    if (workers_env != nullptr && !PLCConfig::parse_int(workers_env, &workers)) {
+        std::cerr << "Ignoring invalid PLC_HOST_WORKERS=" << workers_env << std::endl;
+    }
+    
     // Handle command line arguments
-    if (argc > 1) {
-        if (strcmp(argv[1], "--version") == 0) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--version") == 0) {
             std::cout << "Legacy PLC Simulator v2.1" << std::endl;
 #ifdef VIRTUAL_HARDWARE
             std::cout << "Build: Virtual Hardware" << std::endl;
@@ -589,12 +6712,39 @@ int main(int argc, char* argv[]) {
 #endif
             return 0;
         }
-        else if (strcmp(argv[1], "--help") == 0) {
+        else if (strcmp(argv[i], "--help") == 0) {
             std::cout << "Legacy PLC Simulator" << std::endl;
             std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
             std::cout << "Options:" << std::endl;
-            std::cout << "  --version    Show version information" << std::endl;
-            std::cout << "  --help       Show this help" << std::endl;
+            std::cout << "  --version          Show version information" << std::endl;
+            std::cout << "  --help             Show this help" << std::endl;
+            std::cout << "  --scan-period MS   MAST (main scan) period, default 100 (env PLC_SCAN_PERIOD_MS)" << std::endl;
+            std::cout << "  --fast-period MS   FAST task period for the I/O interlock rungs, 0 = off (env PLC_FAST_PERIOD_MS)" << std::endl;
+            std::cout << "  --program FILE     IL control program, default built-in (env PLC_PROGRAM)" << std::endl;
+            std::cout << "  --rung-budget-us N Time every rung, flag those over N us, 0 = off (env PLC_RUNG_BUDGET_US)" << std::endl;
+            std::cout << "  --log-format F     Data log as binary, delta (changes only) or csv (env PLC_LOG_FORMAT)" << std::endl;
+            std::cout << "  --log-deadbands S  Delta log deadbands, e.g. I0=2,I3=1,MW100=2 (env PLC_LOG_DEADBANDS)" << std::endl;
+            std::cout << "  --log-dir DIR      Data log segment directory (env PLC_LOG_DIR)" << std::endl;
+            std::cout << "  --log-segment-mb N Segment file size, rotated when full (env PLC_LOG_SEGMENT_MB)" << std::endl;
+            std::cout << "  --log-retention-mb N  Total segment size kept, 0 = all (env PLC_LOG_RETENTION_MB)" << std::endl;
+            std::cout << "  --history-mb N     Memory for the /history trend ring, 0 = off (env PLC_HISTORY_MB)" << std::endl;
+            std::cout << "  --trace-events N   Trace the newest N scan and network events, 0 = off (env PLC_TRACE_EVENTS)" << std::endl;
+            std::cout << "  --snapshot-ms N    Save retained memory every N ms for warm restarts, 0 = off (env PLC_SNAPSHOT_MS)" << std::endl;
+            std::cout << "  --load-delay-ms N  Emulate the original controller's program load time (env PLC_LOAD_DELAY_MS)" << std::endl;
+            std::cout << "  --listen-backlog N Pending connections per port, default 64 (env PLC_LISTEN_BACKLOG)" << std::endl;
+            std::cout << "  --max-control-clients N  Sessions on the control and Modbus ports, default 16 (env PLC_MAX_CONTROL_CLIENTS)" << std::endl;
+            std::cout << "  --max-mgmt-clients N     Sessions on the management port, default 64 (env PLC_MAX_MGMT_CLIENTS)" << std::endl;
+            std::cout << "  --control-rate N   Requests/s per control or Modbus session, 0 = unlimited (env PLC_CONTROL_RATE)" << std::endl;
+            std::cout << "  --mgmt-rate N      Requests/s per management session, 0 = unlimited (env PLC_MGMT_RATE)" << std::endl;
+            std::cout << "  --export-csv PATH  Convert a segment file, or every segment in a directory, to CSV and exit" << std::endl;
+            std::cout << "  --from-cycle N     With --export-csv: start at cycle N using the segment index" << std::endl;
+            std::cout << "  --rt-priority N    Run the scan thread SCHED_FIFO at priority N (1-99, env PLC_RT_PRIORITY)" << std::endl;
+            std::cout << "  --cpu N            Pin the scan thread to CPU N (env PLC_CPU_AFFINITY)" << std::endl;
+            std::cout << "  --port-offset N    Add N to both listening ports (env PLC_PORT_OFFSET)" << std::endl;
+            std::cout << "  --modbus-port N    Modbus/TCP server port, 0 = off (env PLC_MODBUS_PORT)" << std::endl;
+            std::cout << "  --sim-seed N       Seed of the simulated process inputs, default 1 (env PLC_SIM_SEED)" << std::endl;
+            std::cout << "  --host FILE        Run every PLC instance listed in FILE in this process (env PLC_HOST_CONFIG)" << std::endl;
+            std::cout << "  --workers N        Host mode scan threads, default one per CPU (env PLC_HOST_WORKERS)" << std::endl;
             std::cout << std::endl;
             std::cout << "Network Interfaces:" << std::endl;
 #ifdef VIRTUAL_HARDWARE
@@ -606,24 +6756,97 @@ int main(int argc, char* argv[]) {
 #endif
             return 0;
         }
+        else if (strcmp(argv[i], "--export-csv") == 0 && i + 1 < argc) {
+            export_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+            host_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            if (!PLCConfig::parse_int(argv[++i], &workers) || workers < 1) {
+                std::cerr << "Invalid worker count: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--from-cycle") == 0 && i + 1 < argc) {
+            int cycle;
+            if (!PLCConfig::parse_int(argv[++i], &cycle) || cycle < 0) {
+                std::cerr << "Invalid cycle: " << argv[i] << std::endl;
+                return 1;
+            }
+            from_cycle = static_cast<uint32_t>(cycle);
+        }
+        else if (!config.parse_option(argc, argv, i)) {
+            std::cerr << "Invalid option: " << argv[i] << " (see --help)" << std::endl;
+            return 1;
+        }
+    }
+    if (export_path != nullptr) {
+        return LegacyPLC::export_log_csv(export_path, from_cycle);
+    }
+    if (!config.validate()) {
+        return 1;
     }
     
 #ifdef VIRTUAL_HARDWARE
-    std::cout << "Starting Legacy PLC Simulator in Virtual Cluster Mode" << std::endl;
-    std::cout << "Simulating: Schneider/Modicon TSX Premium (circa 2004)" << std::endl;
-    std::cout << "Virtual Hardware: No GPIO dependencies" << std::endl;
+    console.info("Starting Legacy PLC Simulator in Virtual Cluster Mode");
+    console.info("Simulating: Schneider/Modicon TSX Premium (circa 2004)");
+    console.info("Virtual Hardware: No GPIO dependencies");
 #else
-    std::cout << "Starting Legacy PLC Simulator on Raspberry Pi Model B" << std::endl;
-    std::cout << "Simulating: Schneider/Modicon TSX Premium (circa 2004)" << std::endl;
+    console.info("Starting Legacy PLC Simulator on Raspberry Pi Model B");
+    console.info("Simulating: Schneider/Modicon TSX Premium (circa 2004)");
 #endif
     
-    LegacyPLC plc;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    action.sa_handler = request_trace;
+    sigaction(SIGUSR1, &action, nullptr);
+    action.sa_handler = request_reload;
+    sigaction(SIGHUP, &action, nullptr);
+    
+    if (host_path != nullptr) {
+        if (workers < 1) workers = static_cast<int>(std::thread::hardware_concurrency());
+        PLCHost host(config, workers);
+        if (!host.load(host_path)) {
+            return 1;
+        }
+        if (!host.start()) {
+            return 1;
+        }
+        while (!stop_requested) {
+            host.handle_network_communication(1000);
+            if (trace_requested) {
+                trace_requested = 0;
+                host.dump_trace();
+            }
+            if (reload_requested) {
+                reload_requested = 0;
+                host.reload_programs();
+            }
+        }
+        return 0;
+    }
+    
+    LegacyPLC plc(config);
+    plc.start();
     
-    // Main execution loop
-    while (plc.is_running()) {
-        plc.run_scan_cycle();
-        usleep(1000); // Small sleep to prevent 100% CPU usage
+    // Main thread services communications; the scan runs on its own thread
+    while (plc.is_running() && !stop_requested) {
+        plc.handle_network_communication(1000);
+        if (trace_requested) {
+            trace_requested = 0;
+            plc.dump_trace();
+        }
+        if (reload_requested) {
+            reload_requested = 0;
+            plc.reload_program();
+        }
     }
     
     return 0;
 }
+
+#endif // PLC_NO_MAIN